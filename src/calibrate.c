@@ -0,0 +1,343 @@
+/*
+    PS2Encoder - PS2 Keyboard to serial/parallel converter
+    Copyright Jim Brain and RETRO Innovations, 2008-2012
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+    calibrate.c: Tune the internal RC oscillator and bit rate to the host
+
+    The host sends a stream of 'U' (0x55), which on the wire is a square
+    wave with a falling edge every 2 bit times.  Those edges are timed with
+    the free running Timer1 while OSCCAL is binary searched.
+
+    Autobaud times the shortest pulse in whatever the host is sending,
+    which is one bit, and picks the nearest standard rate.  Edges are
+    stamped in a pin change IRQ, so the keyboards keep running meanwhile.
+*/
+
+#include <inttypes.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+#include "config.h"
+#include "calibrate.h"
+#include "flags.h"
+#include "parallel.h"
+#include "timer.h"
+#include "uart.h"
+
+#ifdef UART_AUTOBAUD_SUPPORT
+typedef enum {CAL_ST_IDLE = 0
+             ,CAL_ST_EDGES
+             ,CAL_ST_CONFIRM
+             } calstate_t;
+
+static calstate_t cal_state;
+static uint16_t cal_started;
+static uint16_t cal_bps;
+static volatile uint8_t cal_edges;
+static volatile uint16_t cal_min;
+static volatile uint16_t cal_last;
+static volatile uint16_t cal_last_now;
+
+// rates autobaud will pick from, fastest first.
+static const uint16_t cal_rates[] PROGMEM = {B115200, B76800, B57600, B38400,
+                                             B19200, B9600, B4800, B2400,
+                                             B1200, B0600, B0300
+                                            };
+#endif
+
+// wait for RXD to read level, giving up max ticks after from
+static uint8_t cal_wait_level(uint8_t level, uint16_t from, uint16_t max) {
+  while((uart_rxd() != 0) != level) {
+    if((uint16_t)(PAR_TCNT - from) > max)
+      return FALSE;
+  }
+  return TRUE;
+}
+
+/*
+ * Wait, with IRQs on, for RXD to go low at a start bit.  Inside a 0x55
+ * RXD is never high for more than a bit, so a longer high run is stop
+ * bit and idle line.  Back to back characters have no such run, so stop
+ * looking after the 5 lows of a character, any low lines up then.
+ */
+static uint8_t cal_wait_start(uint16_t bit) {
+  uint16_t start = timer_now();
+  uint16_t high = PAR_TCNT;
+  uint8_t level = TRUE;
+  uint8_t lows = 0;
+
+  while((uint16_t)(PAR_TCNT - high) < bit + bit / 2 && lows < 5) {
+    if(uart_rxd()) {
+      level = TRUE;
+    } else {
+      if(level)
+        lows++;
+      level = FALSE;
+      high = PAR_TCNT;
+    }
+    if((uint16_t)(timer_now() - start) > CAL_WAIT)
+      return FALSE;
+  }
+  while(uart_rxd()) {
+    if((uint16_t)(timer_now() - start) > CAL_WAIT)
+      return FALSE;
+  }
+  return TRUE;
+}
+
+/*
+ * Time a 0x55 from the end of its start bit to the start of its stop
+ * bit, CAL_RISES rising edges 2 bit times apart.  Returns 0 if an edge
+ * is out of place, i.e. the low we started in was not the start bit and
+ * the window ran into the idle gap.  Call with IRQs off, it takes at
+ * most a character time.
+ */
+static uint16_t cal_time_char(uint16_t bit) {
+  uint16_t start;
+  uint16_t last;
+  uint16_t now;
+  uint8_t i;
+
+  now = PAR_TCNT;
+  if(!cal_wait_level(TRUE, now, bit + bit / 2))
+    return 0;
+  start = last = PAR_TCNT;
+  for(i = 0; i < CAL_RISES; i++) {
+    if(!cal_wait_level(FALSE, last, bit + bit / 2) || !cal_wait_level(TRUE, last, bit * 2 + bit / 2))
+      return 0;
+    now = PAR_TCNT;
+    if((uint16_t)(now - last) < bit + bit / 2)
+      return 0;
+    last = now;
+  }
+  return last - start;
+}
+
+// total ticks for CAL_SAMPLES characters, 0 if the host went quiet.
+static uint32_t cal_measure(uint16_t bit) {
+  uint32_t total = 0;
+  uint16_t ticks = 0;
+  uint8_t i;
+  uint8_t tries;
+
+  for(i = 0; i < CAL_SAMPLES; i++) {
+    for(tries = 0; tries < CAL_TRIES; tries++) {
+      if(!cal_wait_start(bit))
+        return 0;
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        ticks = cal_time_char(bit);
+      }
+      if(ticks)
+        break;
+    }
+    if(!ticks)
+      return 0;
+    total += ticks;
+  }
+  return total;
+}
+
+/*
+ * Binary search the low 7 bits of OSCCAL (bit 7 selects the range on
+ * the newer parts, the mega8's is one linear 8 bit value) until the
+ * host's bits are as long as bps says they should be.  OSCCAL is left
+ * untouched on failure.
+ */
+#ifdef __AVR_ATmega8__
+#  define CAL_OSCCAL_KEEP     0x00
+#  define CAL_OSCCAL_TOP      0x80
+#else
+#  define CAL_OSCCAL_KEEP     0x80
+#  define CAL_OSCCAL_TOP      0x40
+#endif
+
+uint8_t cal_osccal(uint16_t bps) {
+  uint16_t bit;
+  uint32_t expected;
+  uint32_t ticks;
+  uint8_t old = OSCCAL;
+  uint8_t cal = OSCCAL & CAL_OSCCAL_KEEP;
+  uint8_t mask;
+
+  // nominal bit time in Timer1 (F_CPU/8) ticks
+  bit = (bps & UART_UBRR_MASK) + 1;
+  if(!(bps & UART_U2X))
+    bit *= 2;
+  if(bit < CAL_MIN_BIT)
+    return FALSE;
+  expected = (uint32_t)bit * (2 * CAL_RISES * CAL_SAMPLES);
+
+  // poll the pin ourselves, and don't let garbage reach the buffer.
+  uart_flush();
+  UCSRAB &= (uint8_t)~_BV(RXENA);
+  for(mask = CAL_OSCCAL_TOP; mask; mask >>= 1) {
+    OSCCAL = cal | mask;
+    ticks = cal_measure(bit);
+    if(!ticks) {
+      OSCCAL = old;
+      break;
+    }
+    // too few ticks means we are still running slow.
+    if(ticks <= expected)
+      cal |= mask;
+  }
+  if(!mask)
+    OSCCAL = cal;
+  UCSRAB |= _BV(RXENA);
+  return (mask == 0);
+}
+
+#ifdef UART_AUTOBAUD_SUPPORT
+/*
+ * Stamp every RXD edge and keep the shortest run between two.  A run the
+ * 16 bit count may have wrapped on is checked against the timebase too,
+ * and anything that long is idle line, not a bit.
+ */
+ISR(UART_RXD_vect) {
+  uint16_t ticks = PAR_TCNT;
+  uint16_t now = timer_now();
+  uint16_t run = ticks - cal_last;
+
+  if(cal_edges
+     && (uint16_t)(now - cal_last_now) < (CAL_MAX_RUN >> 8)
+     && run < cal_min)
+    cal_min = run;
+  cal_last = ticks;
+  cal_last_now = now;
+  if(cal_edges < CAL_BAUD_EDGES)
+    cal_edges++;
+}
+
+// nominal bit time of a CALC_BPS() value in Timer1 ticks
+static uint16_t cal_bit_ticks(uint16_t bps) {
+  uint16_t bit = (bps & UART_UBRR_MASK) + 1;
+
+  return (bps & UART_U2X ? bit : bit * 2);
+}
+
+// the standard rate nearest a bit time, 0 if none is within 1/8 bit.
+static uint16_t cal_nearest(uint16_t min) {
+  uint16_t bps = 0;
+  uint16_t bit;
+  uint16_t diff;
+  uint16_t best = 0xffff;
+  uint8_t i;
+
+  for(i = 0; i < sizeof(cal_rates) / sizeof(cal_rates[0]); i++) {
+    bit = cal_bit_ticks(pgm_read_word(&cal_rates[i]));
+    diff = (bit > min ? bit - min : min - bit);
+    if(diff < best) {
+      best = diff;
+      bps = pgm_read_word(&cal_rates[i]);
+    }
+  }
+  if(best > cal_bit_ticks(bps) / 8)
+    return 0;
+  return bps;
+}
+
+/*
+ * Start hunting for the host's bit rate.  The receiver is off meanwhile,
+ * so garbage does not reach the buffer, and RXD edges are timed by the
+ * IRQ above.  cal_autobaud_task() does the rest from the main loop.
+ */
+void cal_autobaud_start(void) {
+  UCSRAB &= (uint8_t)~_BV(RXENA);
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    cal_edges = 0;
+    cal_min = CAL_MAX_RUN;
+  }
+  cal_started = timer_now();
+  cal_state = CAL_ST_EDGES;
+  uart_rxd_irq_on();
+}
+
+// give up, the UART goes back to the configured rate.
+void cal_autobaud_stop(void) {
+  if(cal_state == CAL_ST_IDLE)
+    return;
+  uart_rxd_irq_off();
+  cal_state = CAL_ST_IDLE;
+  uart_config(uart_bps, uart_length, uart_parity, uart_stop);
+  UCSRAB |= _BV(RXENA);
+}
+
+uint8_t cal_autobaud_busy(void) {
+  return (cal_state != CAL_ST_IDLE);
+}
+
+// TRUE when cal_autobaud_task() has something to do.
+uint8_t cal_autobaud_ready(void) {
+  switch(cal_state) {
+  case CAL_ST_EDGES:
+    return (cal_edges >= CAL_BAUD_EDGES
+            || (uint16_t)(timer_now() - cal_started) > CAL_WAIT);
+  case CAL_ST_CONFIRM:
+    return (uart_data_available()
+            || uart_rx_error_pending()
+            || (uint16_t)(timer_now() - cal_started) > CAL_WAIT);
+  default:
+    return FALSE;
+  }
+}
+
+/*
+ * Once enough edges are in, switch the UART to the nearest rate and make
+ * sure the next character arrives without a framing error.  Returns the
+ * new CALC_BPS() value once confirmed, otherwise 0.  Never waits.
+ */
+uint16_t cal_autobaud_task(void) {
+  uint16_t min;
+
+  switch(cal_state) {
+  case CAL_ST_EDGES:
+    if(cal_edges < CAL_BAUD_EDGES) {
+      if((uint16_t)(timer_now() - cal_started) > CAL_WAIT)
+        cal_autobaud_stop();
+      break;
+    }
+    uart_rxd_irq_off();
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      min = cal_min;
+    }
+    cal_bps = cal_nearest(min);
+    if(!cal_bps) {
+      cal_autobaud_stop();
+      break;
+    }
+    // confirm with the next character through the real receiver.
+    uart_config(cal_bps, uart_length, uart_parity, uart_stop);
+    uart_rx_errors();
+    UCSRAB |= _BV(RXENA);
+    cal_started = timer_now();
+    cal_state = CAL_ST_CONFIRM;
+    break;
+  case CAL_ST_CONFIRM:
+    if(uart_data_available()) {
+      cal_state = CAL_ST_IDLE;
+      return cal_bps;
+    }
+    if(uart_rx_errors() || (uint16_t)(timer_now() - cal_started) > CAL_WAIT)
+      cal_autobaud_stop();
+    break;
+  default:
+    break;
+  }
+  return 0;
+}
+#endif
@@ -0,0 +1,56 @@
+/*
+    PS2Encoder - PS2 Keyboard to serial/parallel converter
+    Copyright Jim Brain and RETRO Innovations, 2008-2012
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+    calibrate.h: public functions for clock calibration
+
+*/
+
+#ifndef CALIBRATE_H
+#define CALIBRATE_H
+
+// characters timed for each OSCCAL step
+#define CAL_SAMPLES           4
+// rising edges timed per 0x55 character, 2 bit times apart
+#define CAL_RISES             4
+// characters we may miss the start of, per sample
+#define CAL_TRIES             8
+// how long to wait for the host before giving up
+#define CAL_WAIT              TIMER_MS(3000)
+// shortest usable bit time in timer ticks, ~38400 bps at 8MHz
+#define CAL_MIN_BIT           24
+// RXD edges timed when hunting for the host's bit rate, a few characters
+#define CAL_BAUD_EDGES        40
+// longest run of one level we will time, ~9 bits at 300 bps
+#define CAL_MAX_RUN           0x8000
+
+uint8_t cal_osccal(uint16_t bps);
+#ifdef UART_AUTOBAUD_SUPPORT
+void cal_autobaud_start(void);
+void cal_autobaud_stop(void);
+uint8_t cal_autobaud_busy(void);
+uint8_t cal_autobaud_ready(void);
+uint16_t cal_autobaud_task(void);
+#else
+#  define cal_autobaud_start()  do {} while(0)
+#  define cal_autobaud_stop()   do {} while(0)
+#  define cal_autobaud_busy()   FALSE
+#  define cal_autobaud_ready()  FALSE
+#  define cal_autobaud_task()   0
+#endif
+
+#endif
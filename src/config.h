@@ -46,7 +46,49 @@
 
 #define UART0_ENABLE
 // log2 of the UART buffer size, i.e. 6 for 64, 7 for 128, 8 for 256 etc.
-#define UART0_TX_BUFFER_SHIFT 5
+#ifdef CONFIG_UART_TX_BUFFER_SHIFT
+#  define UART0_TX_BUFFER_SHIFT CONFIG_UART_TX_BUFFER_SHIFT
+#else
+#  define UART0_TX_BUFFER_SHIFT 5
+#endif
+#define UART0_RX_BUFFER_SHIFT 6
+
+#ifdef CONFIG_MATRIX
+// a key matrix on the parallel port data pins, read like another keyboard
+#  define MATRIX_SUPPORT
+#  ifdef CONFIG_MATRIX_DEFER
+// debounce by waiting for keys to settle, instead of locking them out
+#    define MAT_DB_DEFER
+#  endif
+#else
+// pass bytes received on the UART through to the parallel port
+#  define BRIDGE_SUPPORT
+#endif
+
+#ifdef CONFIG_PS2_MOUSE
+// PS/2 mouse on the second PS/2 port, passed to the host as a serial mouse
+#  define PS2_MOUSE_SUPPORT
+#endif
+
+#ifdef CONFIG_KB_MERGE
+// a second keyboard on the second PS/2 port, i.e. a keypad
+#  define PS2_KB_MERGE
+#endif
+
+#ifdef CONFIG_PS2_PASSTHRU
+// device mode reads a PS/2 keyboard on the second PS/2 port instead of XT
+#  define PS2_PASSTHRU
+#endif
+
+#ifdef CONFIG_SWAP_CAPS_CTRL
+// swap Caps Lock and left Ctrl on the way through
+#  define KM_SWAP_CAPS_CTRL
+#endif
+
+#ifdef CONFIG_XT_SUPPORT
+// without the device mode jumper, probe for an XT keyboard at power-up
+#  define KB_AUTODETECT
+#endif
 
 #define UART0_BAUDRATE CONFIG_UART_BAUDRATE
 #define DYNAMIC_UART
@@ -61,11 +103,31 @@
 #  define PS2_DATA_IN    PIND
 #  define PS2_DATA_PIN   _BV(PD3)
 
+// a second PS/2 port shares the XT connector
+#  ifdef CONFIG_PS2_PORTS
+#    define PS2_PORTS    CONFIG_PS2_PORTS
+#  endif
+#  if defined PS2_PORTS && PS2_PORTS > 1
+#    ifdef CONFIG_XT_SUPPORT
+#      error "The second PS/2 port needs CONFIG_XT_SUPPORT turned off"
+#    endif
+#    define PS2_1_CLK_DDR    DDRB
+#    define PS2_1_CLK_OUT    PORTB
+#    define PS2_1_CLK_IN     PINB
+#    define PS2_1_CLK_PIN    _BV(PB5)
+#    define PS2_1_DATA_DDR   DDRB
+#    define PS2_1_DATA_OUT   PORTB
+#    define PS2_1_DATA_IN    PINB
+#    define PS2_1_DATA_PIN   _BV(PB4)
+#  endif
+
 static inline __attribute__((always_inline)) void data_init(void) {
+#  ifndef CONFIG_MATRIX
   DDRB |= 0x0f;
   PORTB &= ~0x0f;
   DDRC |= 0x0f;
   PORTC &= ~0x0f;
+#  endif
   DDRD  |= _BV(PD7); // strobe
 }
 
@@ -82,6 +144,86 @@ static inline __attribute__((always_inline)) void data_strobe_lo(void) {
   PORTD &= ~_BV(PD7);
 }
 
+// parallel handshake input, optional.  Pulled up, high means target is busy
+// PB6 is XTAL1 on crystal builds, so those leave it alone.
+#  ifdef CONFIG_PAR_BUSY
+#    define PAR_BUSY_SUPPORT
+static inline __attribute__((always_inline)) void busy_init(void) {
+  DDRB &= ~_BV(PB6);
+  PORTB |= _BV(PB6);
+}
+
+static inline __attribute__((always_inline)) uint8_t data_busy(void) {
+  return (PINB & _BV(PB6));
+}
+#  else
+static inline __attribute__((always_inline)) void busy_init(void) {
+}
+
+static inline __attribute__((always_inline)) uint8_t data_busy(void) {
+  return FALSE;
+}
+#  endif
+
+// raw level of the UART receive pin, used to time incoming bits
+static inline __attribute__((always_inline)) uint8_t uart_rxd(void) {
+  return (PIND & _BV(PD0));
+}
+
+// pin change IRQ on every RXD edge, autobaud times the host with it
+#  ifdef PCMSK2
+#    define UART_AUTOBAUD_SUPPORT
+#    define UART_RXD_vect   PCINT2_vect
+static inline __attribute__((always_inline)) void uart_rxd_irq_on(void) {
+  PCMSK2 |= _BV(PCINT16);
+  PCIFR = _BV(PCIF2);
+  PCICR |= _BV(PCIE2);
+}
+
+static inline __attribute__((always_inline)) void uart_rxd_irq_off(void) {
+  PCICR &= (uint8_t)~_BV(PCIE2);
+  PCMSK2 &= (uint8_t)~_BV(PCINT16);
+}
+#  endif
+
+// CTS input, asserted low at TTL level.  Pin change IRQ restarts the sender
+#  ifdef PCMSK1
+#    define UART0_CTS_SUPPORT
+#    define UART0_CTS_vect  PCINT1_vect
+static inline __attribute__((always_inline)) void uart_cts_init(void) {
+  DDRC &= ~_BV(PC4);
+  PORTC |= _BV(PC4);
+  PCMSK1 |= _BV(PCINT12);
+}
+
+// this must return non-zero when the receiver is ready
+static inline __attribute__((always_inline)) uint8_t uart_cts(void) {
+  return !(PINC & _BV(PC4));
+}
+
+static inline __attribute__((always_inline)) void uart_cts_irq_on(void) {
+  PCICR |= _BV(PCIE1);
+}
+
+static inline __attribute__((always_inline)) void uart_cts_irq_off(void) {
+  PCICR &= (uint8_t)~_BV(PCIE1);
+}
+#  endif
+
+// RTS output, asserted low at TTL level (inverted by the line driver)
+#  define UART0_RTS_SUPPORT
+static inline __attribute__((always_inline)) void uart_rts_init(void) {
+  DDRC |= _BV(PC5);
+}
+
+static inline __attribute__((always_inline)) void uart_rts_on(void) {
+  PORTC &= ~_BV(PC5);
+}
+
+static inline __attribute__((always_inline)) void uart_rts_off(void) {
+  PORTC |= _BV(PC5);
+}
+
 static inline __attribute__((always_inline)) void reset_init(void) {
   DDRD |= _BV(PD6);
   PORTD |= _BV(PD6);
@@ -109,7 +251,7 @@ static inline __attribute__((always_inline)) uint8_t mode_config(void) {
 
 // this must return non-zero for device mode
 static inline __attribute__((always_inline)) uint8_t mode_device(void) {
-#ifdef CONFIG_XT_SUPPORT
+#if defined CONFIG_XT_SUPPORT || defined PS2_PASSTHRU || defined MATRIX_SUPPORT
   return !(PIND & _BV(PD4));
 #else
   return FALSE;
@@ -126,30 +268,26 @@ static inline __attribute__((always_inline)) uint8_t mode_device(void) {
 //#  define SW_C                (PB6)
 //#  define SW_D                (PB7)
 
-//#  define MAT_RX_BUFFER_SHIFT 4
-//#  define MAT_ROW_LO_DDR      DDRB
-//#  define MAT_ROW_LO_OUT      PORTB
-//#  define MAT_ROW_MASK        0x0f
-//#  define MAT_COL_LO_DDR      DDRC
-//#  define MAT_COL_LO_OUT      PORTC
-//#  define MAT_COL_LO_IN       PINC
-//#  define MAT_COL_MASK        0x0f
-
-//static inline __attribute__((always_inline)) void timer_init (void) {
-//  TCCR0A |= _BV(WGM01);
-//  TCCR0B |= (_BV(CS02) | _BV(CS00));
-//  OCR0A = 65;
-//  TIMSK0 |= _BV(OCIE0A);
-//}
-
-//static inline __attribute__((always_inline)) void timer_init (void) {
-//  TCCR1B |= (_BV(WGM12) | _BV(CS12));
-//  OCR1A = 65;
-//  TIMSK1 |= _BV(OCIE1A);
-//}
-
-//#  define TIMER_vect          TIMER0_COMPA_vect
-//#  define TIMER_vect          TIMER1_COMPA_vect
+// 4x4 matrix in place of the parallel port, rows on PB0-3, columns on PC0-3
+#  ifdef CONFIG_MATRIX
+#    ifdef PS2_PASSTHRU
+#      error "CONFIG_MATRIX needs CONFIG_PS2_PASSTHRU turned off"
+#    endif
+#    define MAT_RX_BUFFER_SHIFT 4
+#    define MAT_ROW_LO_DDR      DDRB
+#    define MAT_ROW_LO_OUT      PORTB
+#    define MAT_ROW_MASK        0x0f
+#    define MAT_COL_LO_DDR      DDRC
+#    define MAT_COL_LO_OUT      PORTC
+#    define MAT_COL_LO_IN       PINC
+#    define MAT_COL_MASK        0x0f
+#    define MAT_ROWS            4
+#    define MAT_COLS            4
+// debounce over 1 << MAT_DB_SHIFT scans, a scan is MAT_ROWS mS
+#    define MAT_DB_SHIFT        2
+// the base layer, plus one for each Fn key
+#    define MAT_LAYERS          2
+#  endif
 #endif
 
 #endif /*CONFIG_H*/
@@ -23,8 +23,12 @@
 #include "config.h"
 #include <avr/eeprom.h>
 #include <avr/io.h>
+#include <stddef.h>
 #include "eeprom.h"
 #include "flags.h"
+#include "mouse.h"
+#include "ps2.h"
+#include "xt.h"
 #include "uart.h"
 
 /**
@@ -50,8 +54,21 @@ static EEMEM struct {
   uint8_t   holdoff;
   uint8_t   pulselen;
   uint8_t   resetlen;
+  uint8_t   uart_flow;
+  uint8_t   uart_autobaud;
+  uint8_t   kb_type;
+  uint8_t   ps2_half;
+  uint8_t   ps2_gap;
+  uint8_t   ps2_adapt;
+  uint8_t   xt_timing;
+  uint8_t   xt_adapt;
+  uint8_t   ms_proto;
+  uint8_t   ms_rate;
 } epromconfig;
 
+/* TRUE if a stored structure of size bytes holds all of field f */
+#define EEPROM_HAS(size, f)  ((size) >= offsetof(__typeof__(epromconfig), f) + sizeof(epromconfig.f))
+
 /**
  * read_configuration - reads configuration from EEPROM
  *
@@ -70,6 +87,16 @@ void eeprom_read_config(void) {
   uart_length        = LENGTH_8;
   uart_parity        = PARITY_NONE;
   uart_stop          = STOP_1;
+  uart_flow          = FLOW_NONE;
+  uart_autobaud      = FALSE;
+  kb_type            = KB_TYPE_UNKNOWN;
+  ps2_half           = PS2_HALF_CYCLE;
+  ps2_gap            = PS2_SEND_HOLDOFF_COUNT;
+  ps2_adapt          = FALSE;
+  xt_timing          = XT_TIMING_5150;
+  xt_adapt           = FALSE;
+  ms_proto           = MS_PROTO_OFF;
+  ms_rate            = MS_RATE_100;
   holdoff            = 0;
   pulselen           = 0;
   resetlen           = 0;
@@ -92,13 +119,33 @@ void eeprom_read_config(void) {
 
   tmp = eeprom_read_byte(&epromconfig.globalopts);
   globalopts &= (uint8_t)~(OPT_CRLF | OPT_BACKSPACE |
-                            OPT_STROBE_LO);
+                            OPT_STROBE_LO | OPT_BRIDGE | OPT_HANDSHAKE |
+                            OPT_NO_UART | OPT_NO_PAR);
   globalopts |= tmp;
 
   uart_bps    = eeprom_read_word(&epromconfig.uart_bps);
   uart_length = (uartlen_t)eeprom_read_byte(&epromconfig.uart_length);
   uart_parity = (uartpar_t)eeprom_read_byte(&epromconfig.uart_parity);
   uart_stop   = (uartstop_t)eeprom_read_byte(&epromconfig.uart_stop);
+  if(EEPROM_HAS(size, uart_flow))
+    uart_flow = (uartflow_t)eeprom_read_byte(&epromconfig.uart_flow);
+  if(EEPROM_HAS(size, uart_autobaud))
+    uart_autobaud = eeprom_read_byte(&epromconfig.uart_autobaud);
+  if(EEPROM_HAS(size, kb_type))
+    kb_type = eeprom_read_byte(&epromconfig.kb_type);
+  if(EEPROM_HAS(size, ps2_adapt)) {
+    ps2_half = eeprom_read_byte(&epromconfig.ps2_half);
+    ps2_gap = eeprom_read_byte(&epromconfig.ps2_gap);
+    ps2_adapt = eeprom_read_byte(&epromconfig.ps2_adapt);
+  }
+  if(EEPROM_HAS(size, xt_adapt)) {
+    xt_timing = eeprom_read_byte(&epromconfig.xt_timing);
+    xt_adapt = eeprom_read_byte(&epromconfig.xt_adapt);
+  }
+  if(EEPROM_HAS(size, ms_rate)) {
+    ms_proto = eeprom_read_byte(&epromconfig.ms_proto);
+    ms_rate = eeprom_read_byte(&epromconfig.ms_rate);
+  }
 
   holdoff = eeprom_read_byte(&epromconfig.holdoff);
   pulselen = eeprom_read_byte(&epromconfig.pulselen);
@@ -122,7 +169,9 @@ void eeprom_write_config(void) {
   eeprom_write_byte(&epromconfig.osccal, OSCCAL);
   eeprom_write_byte(&epromconfig.globalopts,
                     globalopts & (OPT_CRLF | OPT_BACKSPACE |
-                                   OPT_STROBE_LO));
+                                   OPT_STROBE_LO | OPT_BRIDGE |
+                                   OPT_HANDSHAKE | OPT_NO_UART |
+                                   OPT_NO_PAR));
   eeprom_write_word(&epromconfig.uart_bps, uart_bps);
   eeprom_write_byte(&epromconfig.uart_length, uart_length);
   eeprom_write_byte(&epromconfig.uart_parity, uart_parity);
@@ -130,6 +179,16 @@ void eeprom_write_config(void) {
   eeprom_write_byte(&epromconfig.holdoff, holdoff);
   eeprom_write_byte(&epromconfig.pulselen, pulselen);
   eeprom_write_byte(&epromconfig.resetlen, resetlen);
+  eeprom_write_byte(&epromconfig.uart_flow, uart_flow);
+  eeprom_write_byte(&epromconfig.uart_autobaud, uart_autobaud);
+  eeprom_write_byte(&epromconfig.kb_type, kb_type);
+  eeprom_write_byte(&epromconfig.ps2_half, ps2_half);
+  eeprom_write_byte(&epromconfig.ps2_gap, ps2_gap);
+  eeprom_write_byte(&epromconfig.ps2_adapt, ps2_adapt);
+  eeprom_write_byte(&epromconfig.xt_timing, xt_timing);
+  eeprom_write_byte(&epromconfig.xt_adapt, xt_adapt);
+  eeprom_write_byte(&epromconfig.ms_proto, ms_proto);
+  eeprom_write_byte(&epromconfig.ms_rate, ms_rate);
 
   /* Calculate checksum over EEPROM contents */
   checksum = 0;
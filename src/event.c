@@ -0,0 +1,76 @@
+/*
+    PS2Encoder - PS2 Keyboard to serial/parallel converter
+    Copyright Jim Brain and RETRO Innovations, 2008-2012
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+    event.c: Merged key event queue
+
+    Every input decoder feeds this one queue, so the translation stage sees
+    a single ordered stream no matter how many keyboards are attached.
+*/
+
+#include <inttypes.h>
+#include <avr/io.h>
+#include <util/atomic.h>
+#include "config.h"
+#include "event.h"
+#include "hid.h"
+#include "timer.h"
+
+static event_t buf[1 << EV_BUFFER_SHIFT];
+static volatile uint8_t head;
+static volatile uint8_t tail;
+
+// safe from IRQ context, for scanners that run off a timer.
+void ev_putc(evsrc_t src, uint8_t code, uint8_t up) {
+  uint8_t tmphead;
+
+  if(code == HID_KEY_NONE)
+    return;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    tmphead = (head + 1) & EV_BUFFER_MASK;
+    if(tmphead != tail) {
+      buf[tmphead].flags = src | (up ? EV_UP : 0);
+      buf[tmphead].code = code;
+      buf[tmphead].time = timer_now();
+      head = tmphead;
+    }
+    // else the queue is full and the event is dropped.
+  }
+}
+
+uint8_t ev_data_available(void) {
+  return (head != tail);
+}
+
+void ev_getc(event_t *ev) {
+  uint8_t tmptail;
+
+  while(head == tail) {
+    // wait for an event
+    ;
+  }
+  tmptail = (tail + 1) & EV_BUFFER_MASK;
+  *ev = buf[tmptail];
+  tail = tmptail;
+}
+
+void ev_clear_buffers(void) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    head = 0;
+    tail = 0;
+  }
+}
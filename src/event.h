@@ -0,0 +1,60 @@
+/*
+    PS2Encoder - PS2 Keyboard to serial/parallel converter
+    Copyright Jim Brain and RETRO Innovations, 2008-2012
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+    event.h: public functions for the merged key event queue
+
+*/
+
+#ifndef EVENT_H
+#define EVENT_H
+
+#ifndef EV_BUFFER_SHIFT
+#  define EV_BUFFER_SHIFT     4
+#endif
+
+#define EV_BUFFER_MASK        (_BV(EV_BUFFER_SHIFT) - 1)
+
+typedef enum {EV_SRC_PS2
+             ,EV_SRC_XT
+             ,EV_SRC_MATRIX
+             ,EV_SRC_SWITCH
+             ,EV_SRC_PS2_1
+             } evsrc_t;
+
+#define EV_SRC_MASK           0x0f
+#define EV_UP                 0x80
+
+/*
+ * One key going down or up.  Whatever the source, code is the USB HID
+ * usage of the key (see hid.h).
+ */
+typedef struct {
+  uint8_t  flags;             // evsrc_t in the low bits, EV_UP on release
+  uint8_t  code;
+  uint16_t time;              // timer_now() when the change was decoded
+} event_t;
+
+#define EV_SOURCE(e)          ((evsrc_t)((e).flags & EV_SRC_MASK))
+#define EV_KEYDOWN(e)         (!((e).flags & EV_UP))
+
+void ev_putc(evsrc_t src, uint8_t code, uint8_t up);
+uint8_t ev_data_available(void);
+void ev_getc(event_t *ev);
+void ev_clear_buffers(void);
+
+#endif
@@ -34,11 +34,30 @@ extern uint16_t uart_bps;
 extern uartlen_t uart_length;
 extern uartstop_t uart_stop;
 extern uartpar_t uart_parity;
+extern uartflow_t uart_flow;
+extern uint8_t uart_autobaud;
+extern uint8_t kb_type;
+extern uint8_t ps2_half;
+extern uint8_t ps2_gap;
+extern uint8_t ps2_adapt;
+extern uint8_t xt_timing;
+extern uint8_t xt_adapt;
+extern uint8_t ms_proto;
+extern uint8_t ms_rate;
+
+/* Values for kb_type, the keyboard found at the last power-up */
+#define KB_TYPE_UNKNOWN  0
+#define KB_TYPE_PS2      1
+#define KB_TYPE_XT       2
 
 /* Values for those flags */
 #define OPT_CRLF         (1 << 0)
 #define OPT_STROBE_LO    (1 << 1)
 #define OPT_BACKSPACE    (1 << 2)
 #define OPT_RESET_HI     (1 << 3)
+#define OPT_BRIDGE       (1 << 4)
+#define OPT_HANDSHAKE    (1 << 5)
+#define OPT_NO_UART      (1 << 6)
+#define OPT_NO_PAR       (1 << 7)
 
 #endif
@@ -0,0 +1,137 @@
+/*
+    PS2Encoder - PS2 Keyboard to serial/parallel converter
+    Copyright Jim Brain and RETRO Innovations, 2008-2012
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+    hid.h: USB HID keyboard usage IDs, the common key code
+
+*/
+
+#ifndef HID_H
+#define HID_H
+
+#define HID_KEY_NONE          0x00
+
+#define HID_KEY_A             0x04
+#define HID_KEY_B             0x05
+#define HID_KEY_C             0x06
+#define HID_KEY_D             0x07
+#define HID_KEY_E             0x08
+#define HID_KEY_F             0x09
+#define HID_KEY_G             0x0a
+#define HID_KEY_H             0x0b
+#define HID_KEY_I             0x0c
+#define HID_KEY_J             0x0d
+#define HID_KEY_K             0x0e
+#define HID_KEY_L             0x0f
+#define HID_KEY_M             0x10
+#define HID_KEY_N             0x11
+#define HID_KEY_O             0x12
+#define HID_KEY_P             0x13
+#define HID_KEY_Q             0x14
+#define HID_KEY_R             0x15
+#define HID_KEY_S             0x16
+#define HID_KEY_T             0x17
+#define HID_KEY_U             0x18
+#define HID_KEY_V             0x19
+#define HID_KEY_W             0x1a
+#define HID_KEY_X             0x1b
+#define HID_KEY_Y             0x1c
+#define HID_KEY_Z             0x1d
+#define HID_KEY_1             0x1e
+#define HID_KEY_2             0x1f
+#define HID_KEY_3             0x20
+#define HID_KEY_4             0x21
+#define HID_KEY_5             0x22
+#define HID_KEY_6             0x23
+#define HID_KEY_7             0x24
+#define HID_KEY_8             0x25
+#define HID_KEY_9             0x26
+#define HID_KEY_0             0x27
+#define HID_KEY_ENTER         0x28
+#define HID_KEY_ESC           0x29
+#define HID_KEY_BS            0x2a
+#define HID_KEY_TAB           0x2b
+#define HID_KEY_SPACE         0x2c
+#define HID_KEY_MINUS         0x2d
+#define HID_KEY_EQUALS        0x2e
+#define HID_KEY_LBRACKET      0x2f
+#define HID_KEY_RBRACKET      0x30
+#define HID_KEY_BACKSLASH     0x31
+#define HID_KEY_INT2          0x32
+#define HID_KEY_SEMICOLON     0x33
+#define HID_KEY_APOSTROPHE    0x34
+#define HID_KEY_BACKQUOTE     0x35
+#define HID_KEY_COMMA         0x36
+#define HID_KEY_PERIOD        0x37
+#define HID_KEY_SLASH         0x38
+#define HID_KEY_CAPS_LOCK     0x39
+#define HID_KEY_F1            0x3a
+#define HID_KEY_F2            0x3b
+#define HID_KEY_F3            0x3c
+#define HID_KEY_F4            0x3d
+#define HID_KEY_F5            0x3e
+#define HID_KEY_F6            0x3f
+#define HID_KEY_F7            0x40
+#define HID_KEY_F8            0x41
+#define HID_KEY_F9            0x42
+#define HID_KEY_F10           0x43
+#define HID_KEY_F11           0x44
+#define HID_KEY_F12           0x45
+#define HID_KEY_PRINT_SCREEN  0x46
+#define HID_KEY_SCROLL_LOCK   0x47
+#define HID_KEY_PAUSE         0x48
+#define HID_KEY_INSERT        0x49
+#define HID_KEY_HOME          0x4a
+#define HID_KEY_PAGE_UP       0x4b
+#define HID_KEY_DELETE        0x4c
+#define HID_KEY_END           0x4d
+#define HID_KEY_PAGE_DOWN     0x4e
+#define HID_KEY_CRSR_RIGHT    0x4f
+#define HID_KEY_CRSR_LEFT     0x50
+#define HID_KEY_CRSR_DOWN     0x51
+#define HID_KEY_CRSR_UP       0x52
+#define HID_KEY_NUM_LOCK      0x53
+#define HID_KEY_NUM_SLASH     0x54
+#define HID_KEY_NUM_STAR      0x55
+#define HID_KEY_NUM_MINUS     0x56
+#define HID_KEY_NUM_PLUS      0x57
+#define HID_KEY_NUM_ENTER     0x58
+#define HID_KEY_NUM_1         0x59
+#define HID_KEY_NUM_2         0x5a
+#define HID_KEY_NUM_3         0x5b
+#define HID_KEY_NUM_4         0x5c
+#define HID_KEY_NUM_5         0x5d
+#define HID_KEY_NUM_6         0x5e
+#define HID_KEY_NUM_7         0x5f
+#define HID_KEY_NUM_8         0x60
+#define HID_KEY_NUM_9         0x61
+#define HID_KEY_NUM_0         0x62
+#define HID_KEY_NUM_PERIOD    0x63
+#define HID_KEY_INT1          0x64
+#define HID_KEY_APPS          0x65
+
+// modifiers
+#define HID_KEY_LCTRL         0xe0
+#define HID_KEY_LSHIFT        0xe1
+#define HID_KEY_ALT           0xe2
+#define HID_KEY_LGUI          0xe3
+#define HID_KEY_RCTRL         0xe4
+#define HID_KEY_RSHIFT        0xe5
+#define HID_KEY_RALT          0xe6
+#define HID_KEY_RGUI          0xe7
+
+#endif
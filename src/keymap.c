@@ -0,0 +1,905 @@
+/*
+    PS2Encoder - PS2 Keyboard to serial/parallel converter
+    Copyright Jim Brain and RETRO Innovations, 2008-2012
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+    keymap.c: scan code <-> HID usage translation
+
+    Every input is decoded to a USB HID usage, and every output is encoded
+    from one, so any input drives any output through two table lookups.
+    A new protocol needs one decode and/or one encode table.
+*/
+
+#include <inttypes.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include "config.h"
+#include "hid.h"
+#include "keymap.h"
+#include "matrix.h"
+#include "ps2.h"
+#include "xt.h"
+
+#define CTRL(x)               (x & 0x1f)
+
+/*
+ * decode tables
+ */
+static const uint8_t ps2_set2[] PROGMEM = {
+  [PS2_KEY_F9]            = HID_KEY_F9,
+  [PS2_KEY_F5]            = HID_KEY_F5,
+  [PS2_KEY_F3]            = HID_KEY_F3,
+  [PS2_KEY_F1]            = HID_KEY_F1,
+  [PS2_KEY_F2]            = HID_KEY_F2,
+  [PS2_KEY_F12]           = HID_KEY_F12,
+  [PS2_KEY_F10]           = HID_KEY_F10,
+  [PS2_KEY_F8]            = HID_KEY_F8,
+  [PS2_KEY_F6]            = HID_KEY_F6,
+  [PS2_KEY_F4]            = HID_KEY_F4,
+  [PS2_KEY_TAB]           = HID_KEY_TAB,
+  [PS2_KEY_BACKQUOTE]     = HID_KEY_BACKQUOTE,
+  [PS2_KEY_ALT]           = HID_KEY_ALT,
+  [PS2_KEY_LSHIFT]        = HID_KEY_LSHIFT,
+  [PS2_KEY_LCTRL]         = HID_KEY_LCTRL,
+  [PS2_KEY_Q]             = HID_KEY_Q,
+  [PS2_KEY_1]             = HID_KEY_1,
+  [PS2_KEY_Z]             = HID_KEY_Z,
+  [PS2_KEY_S]             = HID_KEY_S,
+  [PS2_KEY_A]             = HID_KEY_A,
+  [PS2_KEY_W]             = HID_KEY_W,
+  [PS2_KEY_2]             = HID_KEY_2,
+  [PS2_KEY_C]             = HID_KEY_C,
+  [PS2_KEY_X]             = HID_KEY_X,
+  [PS2_KEY_D]             = HID_KEY_D,
+  [PS2_KEY_E]             = HID_KEY_E,
+  [PS2_KEY_4]             = HID_KEY_4,
+  [PS2_KEY_3]             = HID_KEY_3,
+  [PS2_KEY_SPACE]         = HID_KEY_SPACE,
+  [PS2_KEY_V]             = HID_KEY_V,
+  [PS2_KEY_F]             = HID_KEY_F,
+  [PS2_KEY_T]             = HID_KEY_T,
+  [PS2_KEY_R]             = HID_KEY_R,
+  [PS2_KEY_5]             = HID_KEY_5,
+  [PS2_KEY_N]             = HID_KEY_N,
+  [PS2_KEY_B]             = HID_KEY_B,
+  [PS2_KEY_H]             = HID_KEY_H,
+  [PS2_KEY_G]             = HID_KEY_G,
+  [PS2_KEY_Y]             = HID_KEY_Y,
+  [PS2_KEY_6]             = HID_KEY_6,
+  [PS2_KEY_M]             = HID_KEY_M,
+  [PS2_KEY_J]             = HID_KEY_J,
+  [PS2_KEY_U]             = HID_KEY_U,
+  [PS2_KEY_7]             = HID_KEY_7,
+  [PS2_KEY_8]             = HID_KEY_8,
+  [PS2_KEY_COMMA]         = HID_KEY_COMMA,
+  [PS2_KEY_K]             = HID_KEY_K,
+  [PS2_KEY_I]             = HID_KEY_I,
+  [PS2_KEY_O]             = HID_KEY_O,
+  [PS2_KEY_0]             = HID_KEY_0,
+  [PS2_KEY_9]             = HID_KEY_9,
+  [PS2_KEY_PERIOD]        = HID_KEY_PERIOD,
+  [PS2_KEY_SLASH]         = HID_KEY_SLASH,
+  [PS2_KEY_L]             = HID_KEY_L,
+  [PS2_KEY_SEMICOLON]     = HID_KEY_SEMICOLON,
+  [PS2_KEY_P]             = HID_KEY_P,
+  [PS2_KEY_MINUS]         = HID_KEY_MINUS,
+  [PS2_KEY_APOSTROPHE]    = HID_KEY_APOSTROPHE,
+  [PS2_KEY_INT2]          = HID_KEY_INT2,
+  [PS2_KEY_LBRACKET]      = HID_KEY_LBRACKET,
+  [PS2_KEY_EQUALS]        = HID_KEY_EQUALS,
+  [PS2_KEY_CAPS_LOCK]     = HID_KEY_CAPS_LOCK,
+  [PS2_KEY_RSHIFT]        = HID_KEY_RSHIFT,
+  [PS2_KEY_ENTER]         = HID_KEY_ENTER,
+  [PS2_KEY_RBRACKET]      = HID_KEY_RBRACKET,
+  [PS2_KEY_BACKSLASH]     = HID_KEY_BACKSLASH,
+  [PS2_KEY_INT1]          = HID_KEY_INT1,
+  [PS2_KEY_BS]            = HID_KEY_BS,
+  [PS2_KEY_NUM_1]         = HID_KEY_NUM_1,
+  [PS2_KEY_NUM_4]         = HID_KEY_NUM_4,
+  [PS2_KEY_NUM_7]         = HID_KEY_NUM_7,
+  [PS2_KEY_NUM_0]         = HID_KEY_NUM_0,
+  [PS2_KEY_NUM_PERIOD]    = HID_KEY_NUM_PERIOD,
+  [PS2_KEY_NUM_2]         = HID_KEY_NUM_2,
+  [PS2_KEY_NUM_5]         = HID_KEY_NUM_5,
+  [PS2_KEY_NUM_6]         = HID_KEY_NUM_6,
+  [PS2_KEY_NUM_8]         = HID_KEY_NUM_8,
+  [PS2_KEY_ESC]           = HID_KEY_ESC,
+  [PS2_KEY_NUM_LOCK]      = HID_KEY_NUM_LOCK,
+  [PS2_KEY_F11]           = HID_KEY_F11,
+  [PS2_KEY_NUM_PLUS]      = HID_KEY_NUM_PLUS,
+  [PS2_KEY_NUM_3]         = HID_KEY_NUM_3,
+  [PS2_KEY_NUM_MINUS]     = HID_KEY_NUM_MINUS,
+  [PS2_KEY_NUM_STAR]      = HID_KEY_NUM_STAR,
+  [PS2_KEY_NUM_9]         = HID_KEY_NUM_9,
+  [PS2_KEY_SCROLL_LOCK]   = HID_KEY_SCROLL_LOCK,
+  [PS2_KEY_F7]            = HID_KEY_F7,
+};
+
+// E0 prefixed set 2 codes
+static const uint8_t ps2_set2_ext[][2] PROGMEM = {
+  {PS2_KEY_RALT,         HID_KEY_RALT},
+  {PS2_KEY_RCTRL,        HID_KEY_RCTRL},
+  {PS2_KEY_LGUI,         HID_KEY_LGUI},
+  {PS2_KEY_RGUI,         HID_KEY_RGUI},
+  {PS2_KEY_APPS,         HID_KEY_APPS},
+  {PS2_KEY_NUM_SLASH,    HID_KEY_NUM_SLASH},
+  {PS2_KEY_NUM_ENTER,    HID_KEY_NUM_ENTER},
+  {PS2_KEY_END,          HID_KEY_END},
+  {PS2_KEY_CRSR_LEFT,    HID_KEY_CRSR_LEFT},
+  {PS2_KEY_HOME,         HID_KEY_HOME},
+  {PS2_KEY_INSERT,       HID_KEY_INSERT},
+  {PS2_KEY_DELETE,       HID_KEY_DELETE},
+  {PS2_KEY_CRSR_DOWN,    HID_KEY_CRSR_DOWN},
+  {PS2_KEY_CRSR_RIGHT,   HID_KEY_CRSR_RIGHT},
+  {PS2_KEY_CRSR_UP,      HID_KEY_CRSR_UP},
+  {PS2_KEY_PAGE_DOWN,    HID_KEY_PAGE_DOWN},
+  {PS2_KEY_PRINT_SCREEN, HID_KEY_PRINT_SCREEN},
+  {PS2_KEY_BREAK,        HID_KEY_PAUSE},
+  {PS2_KEY_PAGE_UP,      HID_KEY_PAGE_UP},
+};
+
+#ifdef PS2_SET3_SUPPORT
+// set 3 has no prefixes, each key is a single code.
+static const uint8_t ps2_set3[] PROGMEM = {
+  [0x07]                  = HID_KEY_F1,
+  [0x08]                  = HID_KEY_ESC,
+  [0x0d]                  = HID_KEY_TAB,
+  [0x0e]                  = HID_KEY_BACKQUOTE,
+  [0x0f]                  = HID_KEY_F2,
+  [0x11]                  = HID_KEY_LCTRL,
+  [0x12]                  = HID_KEY_LSHIFT,
+  [0x13]                  = HID_KEY_INT1,
+  [0x14]                  = HID_KEY_CAPS_LOCK,
+  [0x15]                  = HID_KEY_Q,
+  [0x16]                  = HID_KEY_1,
+  [0x17]                  = HID_KEY_F3,
+  [0x19]                  = HID_KEY_ALT,
+  [0x1a]                  = HID_KEY_Z,
+  [0x1b]                  = HID_KEY_S,
+  [0x1c]                  = HID_KEY_A,
+  [0x1d]                  = HID_KEY_W,
+  [0x1e]                  = HID_KEY_2,
+  [0x1f]                  = HID_KEY_F4,
+  [0x21]                  = HID_KEY_C,
+  [0x22]                  = HID_KEY_X,
+  [0x23]                  = HID_KEY_D,
+  [0x24]                  = HID_KEY_E,
+  [0x25]                  = HID_KEY_4,
+  [0x26]                  = HID_KEY_3,
+  [0x27]                  = HID_KEY_F5,
+  [0x29]                  = HID_KEY_SPACE,
+  [0x2a]                  = HID_KEY_V,
+  [0x2b]                  = HID_KEY_F,
+  [0x2c]                  = HID_KEY_T,
+  [0x2d]                  = HID_KEY_R,
+  [0x2e]                  = HID_KEY_5,
+  [0x2f]                  = HID_KEY_F6,
+  [0x31]                  = HID_KEY_N,
+  [0x32]                  = HID_KEY_B,
+  [0x33]                  = HID_KEY_H,
+  [0x34]                  = HID_KEY_G,
+  [0x35]                  = HID_KEY_Y,
+  [0x36]                  = HID_KEY_6,
+  [0x37]                  = HID_KEY_F7,
+  [0x39]                  = HID_KEY_RALT,
+  [0x3a]                  = HID_KEY_M,
+  [0x3b]                  = HID_KEY_J,
+  [0x3c]                  = HID_KEY_U,
+  [0x3d]                  = HID_KEY_7,
+  [0x3e]                  = HID_KEY_8,
+  [0x3f]                  = HID_KEY_F8,
+  [0x41]                  = HID_KEY_COMMA,
+  [0x42]                  = HID_KEY_K,
+  [0x43]                  = HID_KEY_I,
+  [0x44]                  = HID_KEY_O,
+  [0x45]                  = HID_KEY_0,
+  [0x46]                  = HID_KEY_9,
+  [0x47]                  = HID_KEY_F9,
+  [0x49]                  = HID_KEY_PERIOD,
+  [0x4a]                  = HID_KEY_SLASH,
+  [0x4b]                  = HID_KEY_L,
+  [0x4c]                  = HID_KEY_SEMICOLON,
+  [0x4d]                  = HID_KEY_P,
+  [0x4e]                  = HID_KEY_MINUS,
+  [0x4f]                  = HID_KEY_F10,
+  [0x52]                  = HID_KEY_APOSTROPHE,
+  [0x54]                  = HID_KEY_LBRACKET,
+  [0x55]                  = HID_KEY_EQUALS,
+  [0x56]                  = HID_KEY_F11,
+  [0x57]                  = HID_KEY_PRINT_SCREEN,
+  [0x58]                  = HID_KEY_RCTRL,
+  [0x59]                  = HID_KEY_RSHIFT,
+  [0x5a]                  = HID_KEY_ENTER,
+  [0x5b]                  = HID_KEY_RBRACKET,
+  [0x5c]                  = HID_KEY_BACKSLASH,
+  [0x5e]                  = HID_KEY_F12,
+  [0x5f]                  = HID_KEY_SCROLL_LOCK,
+  [0x60]                  = HID_KEY_CRSR_DOWN,
+  [0x61]                  = HID_KEY_CRSR_LEFT,
+  [0x62]                  = HID_KEY_PAUSE,
+  [0x63]                  = HID_KEY_CRSR_UP,
+  [0x64]                  = HID_KEY_DELETE,
+  [0x65]                  = HID_KEY_END,
+  [0x66]                  = HID_KEY_BS,
+  [0x67]                  = HID_KEY_INSERT,
+  [0x69]                  = HID_KEY_NUM_1,
+  [0x6a]                  = HID_KEY_CRSR_RIGHT,
+  [0x6b]                  = HID_KEY_NUM_4,
+  [0x6c]                  = HID_KEY_NUM_7,
+  [0x6d]                  = HID_KEY_PAGE_DOWN,
+  [0x6e]                  = HID_KEY_HOME,
+  [0x6f]                  = HID_KEY_PAGE_UP,
+  [0x70]                  = HID_KEY_NUM_0,
+  [0x71]                  = HID_KEY_NUM_PERIOD,
+  [0x72]                  = HID_KEY_NUM_2,
+  [0x73]                  = HID_KEY_NUM_5,
+  [0x74]                  = HID_KEY_NUM_6,
+  [0x75]                  = HID_KEY_NUM_8,
+  [0x76]                  = HID_KEY_NUM_LOCK,
+  [0x77]                  = HID_KEY_NUM_SLASH,
+  [0x79]                  = HID_KEY_NUM_ENTER,
+  [0x7a]                  = HID_KEY_NUM_3,
+  [0x7c]                  = HID_KEY_NUM_PLUS,
+  [0x7d]                  = HID_KEY_NUM_9,
+  [0x7e]                  = HID_KEY_NUM_STAR,
+  [0x84]                  = HID_KEY_NUM_MINUS,
+  [0x8b]                  = HID_KEY_LGUI,
+  [0x8c]                  = HID_KEY_RGUI,
+  [0x8d]                  = HID_KEY_APPS,
+};
+#endif
+
+static const uint8_t xt_set1[] PROGMEM = {
+  [XT_KEY_ESC]            = HID_KEY_ESC,
+  [XT_KEY_1]              = HID_KEY_1,
+  [XT_KEY_2]              = HID_KEY_2,
+  [XT_KEY_3]              = HID_KEY_3,
+  [XT_KEY_4]              = HID_KEY_4,
+  [XT_KEY_5]              = HID_KEY_5,
+  [XT_KEY_6]              = HID_KEY_6,
+  [XT_KEY_7]              = HID_KEY_7,
+  [XT_KEY_8]              = HID_KEY_8,
+  [XT_KEY_9]              = HID_KEY_9,
+  [XT_KEY_0]              = HID_KEY_0,
+  [XT_KEY_MINUS]          = HID_KEY_MINUS,
+  [XT_KEY_EQUALS]         = HID_KEY_EQUALS,
+  [XT_KEY_BS]             = HID_KEY_BS,
+  [XT_KEY_TAB]            = HID_KEY_TAB,
+  [XT_KEY_Q]              = HID_KEY_Q,
+  [XT_KEY_W]              = HID_KEY_W,
+  [XT_KEY_E]              = HID_KEY_E,
+  [XT_KEY_R]              = HID_KEY_R,
+  [XT_KEY_T]              = HID_KEY_T,
+  [XT_KEY_Y]              = HID_KEY_Y,
+  [XT_KEY_U]              = HID_KEY_U,
+  [XT_KEY_I]              = HID_KEY_I,
+  [XT_KEY_O]              = HID_KEY_O,
+  [XT_KEY_P]              = HID_KEY_P,
+  [XT_KEY_LBRACKET]       = HID_KEY_LBRACKET,
+  [XT_KEY_RBRACKET]       = HID_KEY_RBRACKET,
+  [XT_KEY_ENTER]          = HID_KEY_ENTER,
+  [XT_KEY_LCTRL]          = HID_KEY_LCTRL,
+  [XT_KEY_A]              = HID_KEY_A,
+  [XT_KEY_S]              = HID_KEY_S,
+  [XT_KEY_D]              = HID_KEY_D,
+  [XT_KEY_F]              = HID_KEY_F,
+  [XT_KEY_G]              = HID_KEY_G,
+  [XT_KEY_H]              = HID_KEY_H,
+  [XT_KEY_J]              = HID_KEY_J,
+  [XT_KEY_K]              = HID_KEY_K,
+  [XT_KEY_L]              = HID_KEY_L,
+  [XT_KEY_SEMICOLON]      = HID_KEY_SEMICOLON,
+  [XT_KEY_APOSTROPHE]     = HID_KEY_APOSTROPHE,
+  [XT_KEY_BACKQUOTE]      = HID_KEY_BACKQUOTE,
+  [XT_KEY_LSHIFT]         = HID_KEY_LSHIFT,
+  [XT_KEY_BACKSLASH]      = HID_KEY_BACKSLASH,
+  [XT_KEY_Z]              = HID_KEY_Z,
+  [XT_KEY_X]              = HID_KEY_X,
+  [XT_KEY_C]              = HID_KEY_C,
+  [XT_KEY_V]              = HID_KEY_V,
+  [XT_KEY_B]              = HID_KEY_B,
+  [XT_KEY_N]              = HID_KEY_N,
+  [XT_KEY_M]              = HID_KEY_M,
+  [XT_KEY_COMMA]          = HID_KEY_COMMA,
+  [XT_KEY_PERIOD]         = HID_KEY_PERIOD,
+  [XT_KEY_SLASH]          = HID_KEY_SLASH,
+  [XT_KEY_RSHIFT]         = HID_KEY_RSHIFT,
+  [XT_KEY_NUM_STAR]       = HID_KEY_NUM_STAR,
+  [XT_KEY_ALT]            = HID_KEY_ALT,
+  [XT_KEY_SPACE]          = HID_KEY_SPACE,
+  [XT_KEY_CAPS_LOCK]      = HID_KEY_CAPS_LOCK,
+  [XT_KEY_F1]             = HID_KEY_F1,
+  [XT_KEY_F2]             = HID_KEY_F2,
+  [XT_KEY_F3]             = HID_KEY_F3,
+  [XT_KEY_F4]             = HID_KEY_F4,
+  [XT_KEY_F5]             = HID_KEY_F5,
+  [XT_KEY_F6]             = HID_KEY_F6,
+  [XT_KEY_F7]             = HID_KEY_F7,
+  [XT_KEY_F8]             = HID_KEY_F8,
+  [XT_KEY_F9]             = HID_KEY_F9,
+  [XT_KEY_F10]            = HID_KEY_F10,
+  [XT_KEY_NUM_LOCK]       = HID_KEY_NUM_LOCK,
+  [XT_KEY_SCROLL_LOCK]    = HID_KEY_SCROLL_LOCK,
+  [XT_KEY_NUM_7]          = HID_KEY_NUM_7,
+  [XT_KEY_NUM_8]          = HID_KEY_NUM_8,
+  [XT_KEY_NUM_9]          = HID_KEY_NUM_9,
+  [XT_KEY_NUM_MINUS]      = HID_KEY_NUM_MINUS,
+  [XT_KEY_NUM_4]          = HID_KEY_NUM_4,
+  [XT_KEY_NUM_5]          = HID_KEY_NUM_5,
+  [XT_KEY_NUM_6]          = HID_KEY_NUM_6,
+  [XT_KEY_NUM_PLUS]       = HID_KEY_NUM_PLUS,
+  [XT_KEY_NUM_1]          = HID_KEY_NUM_1,
+  [XT_KEY_NUM_2]          = HID_KEY_NUM_2,
+  [XT_KEY_NUM_3]          = HID_KEY_NUM_3,
+  [XT_KEY_NUM_0]          = HID_KEY_NUM_0,
+  [XT_KEY_NUM_PERIOD]     = HID_KEY_NUM_PERIOD,
+  [XT_KEY_SYSRQ]          = HID_KEY_PRINT_SCREEN,
+  [XT_KEY_INT1]           = HID_KEY_INT1,
+  [XT_KEY_F11]            = HID_KEY_F11,
+  [XT_KEY_F12]            = HID_KEY_F12,
+};
+
+// E0 prefixed set 1 codes
+static const uint8_t xt_set1_ext[][2] PROGMEM = {
+  {XT_KEY_NUM_ENTER,     HID_KEY_NUM_ENTER},
+  {XT_KEY_RCTRL,         HID_KEY_RCTRL},
+  {XT_KEY_NUM_SLASH,     HID_KEY_NUM_SLASH},
+  {XT_KEY_PRINT_SCREEN,  HID_KEY_PRINT_SCREEN},
+  {XT_KEY_RALT,          HID_KEY_RALT},
+  {XT_KEY_BREAK,         HID_KEY_PAUSE},
+  {XT_KEY_HOME,          HID_KEY_HOME},
+  {XT_KEY_CRSR_UP,       HID_KEY_CRSR_UP},
+  {XT_KEY_PAGE_UP,       HID_KEY_PAGE_UP},
+  {XT_KEY_CRSR_LEFT,     HID_KEY_CRSR_LEFT},
+  {XT_KEY_CRSR_RIGHT,    HID_KEY_CRSR_RIGHT},
+  {XT_KEY_END,           HID_KEY_END},
+  {XT_KEY_CRSR_DOWN,     HID_KEY_CRSR_DOWN},
+  {XT_KEY_PAGE_DOWN,     HID_KEY_PAGE_DOWN},
+  {XT_KEY_INSERT,        HID_KEY_INSERT},
+  {XT_KEY_DELETE,        HID_KEY_DELETE},
+  {XT_KEY_LGUI,          HID_KEY_LGUI},
+  {XT_KEY_RGUI,          HID_KEY_RGUI},
+  {XT_KEY_APPS,          HID_KEY_APPS},
+};
+
+/*
+ * prefix sequences
+ *
+ * Each state is a run of {code, flags, out} edges, ended by an SQ_ANY edge
+ * that catches every other code.  An edge either moves to another state or
+ * emits an event and returns to the start state.  out is a fixed HID usage
+ * or a KM_DEC_* selector that decodes the code through a table above.
+ * A new multi-code key is a few more rows here.
+ */
+#define SQ_ANY                0x80
+#define SQ_EMIT               0x40
+// up/down comes from bit 7 of the code, as in set 1.
+#define SQ_SET1               0x04
+#define SQ_STATE_MASK         0x3f
+
+#define KM_DEC_PS2            0xf0
+#define KM_DEC_PS2_EXT        0xf1
+#define KM_DEC_XT             0xf2
+#define KM_DEC_XT_EXT         0xf3
+
+enum {
+  S2_IDLE         = 0,
+  S2_UP           = S2_IDLE + 8,
+  S2_EXT          = S2_UP + 1,
+  S2_EXT_UP       = S2_EXT + 4,
+  S2_PAUSE_1      = S2_EXT_UP + 3,
+  S2_PAUSE_2      = S2_PAUSE_1 + 2,
+  S2_PAUSE_3      = S2_PAUSE_2 + 2,
+  S2_PAUSE_4      = S2_PAUSE_3 + 2,
+  S2_PAUSE_5      = S2_PAUSE_4 + 2,
+  S2_PAUSE_6      = S2_PAUSE_5 + 2,
+  S2_PAUSE_7      = S2_PAUSE_6 + 2,
+  S1_IDLE         = S2_PAUSE_7 + 2,
+  S1_EXT          = S1_IDLE + 5,
+  S1_PAUSE_1      = S1_EXT + 5,
+  S1_PAUSE_2      = S1_PAUSE_1 + 3,
+  SQ_SIZE         = S1_PAUSE_2 + 3
+};
+
+static const uint8_t seq_table[SQ_SIZE][3] PROGMEM = {
+  // set 2
+  [S2_IDLE]        = {PS2_KEY_EXT,          S2_EXT,                                   0},
+                     {PS2_KEY_UP,           S2_UP,                                    0},
+                     {PS2_KEY_EXT_2,        S2_PAUSE_1,                               0},
+                     {PS2_CMD_ACK,          S2_IDLE,                                  0},
+                     {PS2_CMD_ECHO_RESP,    S2_IDLE,                                  0},
+                     {PS2_CMD_ERROR,        S2_IDLE,                                  0},
+                     {PS2_CMD_OVERFLOW,     S2_IDLE,                                  0},
+                     {0,                    SQ_ANY | SQ_EMIT | KM_SEQ_DOWN,           KM_DEC_PS2},
+  [S2_UP]          = {0,                    SQ_ANY | SQ_EMIT | KM_SEQ_UP,             KM_DEC_PS2},
+  // E0 12/E0 59 fake shifts wrap the grey keys and PrintScreen, eat them.
+  [S2_EXT]         = {PS2_KEY_UP,           S2_EXT_UP,                                0},
+                     {PS2_KEY_LSHIFT,       S2_IDLE,                                  0},
+                     {PS2_KEY_RSHIFT,       S2_IDLE,                                  0},
+                     {0,                    SQ_ANY | SQ_EMIT | KM_SEQ_DOWN,           KM_DEC_PS2_EXT},
+  [S2_EXT_UP]      = {PS2_KEY_LSHIFT,       S2_IDLE,                                  0},
+                     {PS2_KEY_RSHIFT,       S2_IDLE,                                  0},
+                     {0,                    SQ_ANY | SQ_EMIT | KM_SEQ_UP,             KM_DEC_PS2_EXT},
+  // E1 14 77 E1 F0 14 F0 77, Pause has no break code.
+  [S2_PAUSE_1]     = {PS2_KEY_PCTRL,        S2_PAUSE_2,                               0},
+                     {0,                    SQ_ANY | S2_IDLE,                         0},
+  [S2_PAUSE_2]     = {PS2_KEY_PAUSE,        S2_PAUSE_3,                               0},
+                     {0,                    SQ_ANY | S2_IDLE,                         0},
+  [S2_PAUSE_3]     = {PS2_KEY_EXT_2,        S2_PAUSE_4,                               0},
+                     {0,                    SQ_ANY | S2_IDLE,                         0},
+  [S2_PAUSE_4]     = {PS2_KEY_UP,           S2_PAUSE_5,                               0},
+                     {0,                    SQ_ANY | S2_IDLE,                         0},
+  [S2_PAUSE_5]     = {PS2_KEY_PCTRL,        S2_PAUSE_6,                               0},
+                     {0,                    SQ_ANY | S2_IDLE,                         0},
+  [S2_PAUSE_6]     = {PS2_KEY_UP,           S2_PAUSE_7,                               0},
+                     {0,                    SQ_ANY | S2_IDLE,                         0},
+  [S2_PAUSE_7]     = {PS2_KEY_PAUSE,        SQ_EMIT | KM_SEQ_TAP,                     HID_KEY_PAUSE},
+                     {0,                    SQ_ANY | S2_IDLE,                         0},
+  // set 1
+  [S1_IDLE]        = {XT_KEY_EXT,           S1_EXT,                                   0},
+                     {XT_KEY_EXT_2,         S1_PAUSE_1,                               0},
+                     {XT_CMD_ERROR,         S1_IDLE,                                  0},
+                     {XT_CMD_OVERFLOW,      S1_IDLE,                                  0},
+                     {0,                    SQ_ANY | SQ_EMIT | SQ_SET1,               KM_DEC_XT},
+  // E0 2A/E0 36 fake shifts, make or break.
+  [S1_EXT]         = {XT_KEY_LSHIFT,        S1_IDLE,                                  0},
+                     {XT_KEY_LSHIFT | 0x80, S1_IDLE,                                  0},
+                     {XT_KEY_RSHIFT,        S1_IDLE,                                  0},
+                     {XT_KEY_RSHIFT | 0x80, S1_IDLE,                                  0},
+                     {0,                    SQ_ANY | SQ_EMIT | SQ_SET1,               KM_DEC_XT_EXT},
+  // E1 1D 45 on make, E1 9D C5 on break
+  [S1_PAUSE_1]     = {XT_KEY_LCTRL,         S1_PAUSE_2,                               0},
+                     {XT_KEY_LCTRL | 0x80,  S1_PAUSE_2,                               0},
+                     {0,                    SQ_ANY | S1_IDLE,                         0},
+  [S1_PAUSE_2]     = {XT_KEY_PAUSE,         SQ_EMIT | KM_SEQ_DOWN,                    HID_KEY_PAUSE},
+                     {XT_KEY_PAUSE | 0x80,  SQ_EMIT | KM_SEQ_UP,                      HID_KEY_PAUSE},
+                     {0,                    SQ_ANY | S1_IDLE,                         0},
+};
+
+/*
+ * encode tables, KM_EXT marks codes that need an E0 prefix.  Pause and
+ * PrintScreen are multi-code sequences the callers build themselves.
+ */
+static const uint8_t hid_ps2[] PROGMEM = {
+  [KM_INDEX(HID_KEY_A)]             = PS2_KEY_A,
+  [KM_INDEX(HID_KEY_B)]             = PS2_KEY_B,
+  [KM_INDEX(HID_KEY_C)]             = PS2_KEY_C,
+  [KM_INDEX(HID_KEY_D)]             = PS2_KEY_D,
+  [KM_INDEX(HID_KEY_E)]             = PS2_KEY_E,
+  [KM_INDEX(HID_KEY_F)]             = PS2_KEY_F,
+  [KM_INDEX(HID_KEY_G)]             = PS2_KEY_G,
+  [KM_INDEX(HID_KEY_H)]             = PS2_KEY_H,
+  [KM_INDEX(HID_KEY_I)]             = PS2_KEY_I,
+  [KM_INDEX(HID_KEY_J)]             = PS2_KEY_J,
+  [KM_INDEX(HID_KEY_K)]             = PS2_KEY_K,
+  [KM_INDEX(HID_KEY_L)]             = PS2_KEY_L,
+  [KM_INDEX(HID_KEY_M)]             = PS2_KEY_M,
+  [KM_INDEX(HID_KEY_N)]             = PS2_KEY_N,
+  [KM_INDEX(HID_KEY_O)]             = PS2_KEY_O,
+  [KM_INDEX(HID_KEY_P)]             = PS2_KEY_P,
+  [KM_INDEX(HID_KEY_Q)]             = PS2_KEY_Q,
+  [KM_INDEX(HID_KEY_R)]             = PS2_KEY_R,
+  [KM_INDEX(HID_KEY_S)]             = PS2_KEY_S,
+  [KM_INDEX(HID_KEY_T)]             = PS2_KEY_T,
+  [KM_INDEX(HID_KEY_U)]             = PS2_KEY_U,
+  [KM_INDEX(HID_KEY_V)]             = PS2_KEY_V,
+  [KM_INDEX(HID_KEY_W)]             = PS2_KEY_W,
+  [KM_INDEX(HID_KEY_X)]             = PS2_KEY_X,
+  [KM_INDEX(HID_KEY_Y)]             = PS2_KEY_Y,
+  [KM_INDEX(HID_KEY_Z)]             = PS2_KEY_Z,
+  [KM_INDEX(HID_KEY_1)]             = PS2_KEY_1,
+  [KM_INDEX(HID_KEY_2)]             = PS2_KEY_2,
+  [KM_INDEX(HID_KEY_3)]             = PS2_KEY_3,
+  [KM_INDEX(HID_KEY_4)]             = PS2_KEY_4,
+  [KM_INDEX(HID_KEY_5)]             = PS2_KEY_5,
+  [KM_INDEX(HID_KEY_6)]             = PS2_KEY_6,
+  [KM_INDEX(HID_KEY_7)]             = PS2_KEY_7,
+  [KM_INDEX(HID_KEY_8)]             = PS2_KEY_8,
+  [KM_INDEX(HID_KEY_9)]             = PS2_KEY_9,
+  [KM_INDEX(HID_KEY_0)]             = PS2_KEY_0,
+  [KM_INDEX(HID_KEY_ENTER)]         = PS2_KEY_ENTER,
+  [KM_INDEX(HID_KEY_ESC)]           = PS2_KEY_ESC,
+  [KM_INDEX(HID_KEY_BS)]            = PS2_KEY_BS,
+  [KM_INDEX(HID_KEY_TAB)]           = PS2_KEY_TAB,
+  [KM_INDEX(HID_KEY_SPACE)]         = PS2_KEY_SPACE,
+  [KM_INDEX(HID_KEY_MINUS)]         = PS2_KEY_MINUS,
+  [KM_INDEX(HID_KEY_EQUALS)]        = PS2_KEY_EQUALS,
+  [KM_INDEX(HID_KEY_LBRACKET)]      = PS2_KEY_LBRACKET,
+  [KM_INDEX(HID_KEY_RBRACKET)]      = PS2_KEY_RBRACKET,
+  [KM_INDEX(HID_KEY_BACKSLASH)]     = PS2_KEY_BACKSLASH,
+  [KM_INDEX(HID_KEY_INT2)]          = PS2_KEY_INT2,
+  [KM_INDEX(HID_KEY_SEMICOLON)]     = PS2_KEY_SEMICOLON,
+  [KM_INDEX(HID_KEY_APOSTROPHE)]    = PS2_KEY_APOSTROPHE,
+  [KM_INDEX(HID_KEY_BACKQUOTE)]     = PS2_KEY_BACKQUOTE,
+  [KM_INDEX(HID_KEY_COMMA)]         = PS2_KEY_COMMA,
+  [KM_INDEX(HID_KEY_PERIOD)]        = PS2_KEY_PERIOD,
+  [KM_INDEX(HID_KEY_SLASH)]         = PS2_KEY_SLASH,
+  [KM_INDEX(HID_KEY_CAPS_LOCK)]     = PS2_KEY_CAPS_LOCK,
+  [KM_INDEX(HID_KEY_F1)]            = PS2_KEY_F1,
+  [KM_INDEX(HID_KEY_F2)]            = PS2_KEY_F2,
+  [KM_INDEX(HID_KEY_F3)]            = PS2_KEY_F3,
+  [KM_INDEX(HID_KEY_F4)]            = PS2_KEY_F4,
+  [KM_INDEX(HID_KEY_F5)]            = PS2_KEY_F5,
+  [KM_INDEX(HID_KEY_F6)]            = PS2_KEY_F6,
+  [KM_INDEX(HID_KEY_F7)]            = PS2_KEY_F7,
+  [KM_INDEX(HID_KEY_F8)]            = PS2_KEY_F8,
+  [KM_INDEX(HID_KEY_F9)]            = PS2_KEY_F9,
+  [KM_INDEX(HID_KEY_F10)]           = PS2_KEY_F10,
+  [KM_INDEX(HID_KEY_F11)]           = PS2_KEY_F11,
+  [KM_INDEX(HID_KEY_F12)]           = PS2_KEY_F12,
+  [KM_INDEX(HID_KEY_PRINT_SCREEN)]  = PS2_KEY_PRINT_SCREEN | KM_EXT,
+  [KM_INDEX(HID_KEY_SCROLL_LOCK)]   = PS2_KEY_SCROLL_LOCK,
+  [KM_INDEX(HID_KEY_INSERT)]        = PS2_KEY_INSERT | KM_EXT,
+  [KM_INDEX(HID_KEY_HOME)]          = PS2_KEY_HOME | KM_EXT,
+  [KM_INDEX(HID_KEY_PAGE_UP)]       = PS2_KEY_PAGE_UP | KM_EXT,
+  [KM_INDEX(HID_KEY_DELETE)]        = PS2_KEY_DELETE | KM_EXT,
+  [KM_INDEX(HID_KEY_END)]           = PS2_KEY_END | KM_EXT,
+  [KM_INDEX(HID_KEY_PAGE_DOWN)]     = PS2_KEY_PAGE_DOWN | KM_EXT,
+  [KM_INDEX(HID_KEY_CRSR_RIGHT)]    = PS2_KEY_CRSR_RIGHT | KM_EXT,
+  [KM_INDEX(HID_KEY_CRSR_LEFT)]     = PS2_KEY_CRSR_LEFT | KM_EXT,
+  [KM_INDEX(HID_KEY_CRSR_DOWN)]     = PS2_KEY_CRSR_DOWN | KM_EXT,
+  [KM_INDEX(HID_KEY_CRSR_UP)]       = PS2_KEY_CRSR_UP | KM_EXT,
+  [KM_INDEX(HID_KEY_NUM_LOCK)]      = PS2_KEY_NUM_LOCK,
+  [KM_INDEX(HID_KEY_NUM_SLASH)]     = PS2_KEY_NUM_SLASH | KM_EXT,
+  [KM_INDEX(HID_KEY_NUM_STAR)]      = PS2_KEY_NUM_STAR,
+  [KM_INDEX(HID_KEY_NUM_MINUS)]     = PS2_KEY_NUM_MINUS,
+  [KM_INDEX(HID_KEY_NUM_PLUS)]      = PS2_KEY_NUM_PLUS,
+  [KM_INDEX(HID_KEY_NUM_ENTER)]     = PS2_KEY_NUM_ENTER | KM_EXT,
+  [KM_INDEX(HID_KEY_NUM_1)]         = PS2_KEY_NUM_1,
+  [KM_INDEX(HID_KEY_NUM_2)]         = PS2_KEY_NUM_2,
+  [KM_INDEX(HID_KEY_NUM_3)]         = PS2_KEY_NUM_3,
+  [KM_INDEX(HID_KEY_NUM_4)]         = PS2_KEY_NUM_4,
+  [KM_INDEX(HID_KEY_NUM_5)]         = PS2_KEY_NUM_5,
+  [KM_INDEX(HID_KEY_NUM_6)]         = PS2_KEY_NUM_6,
+  [KM_INDEX(HID_KEY_NUM_7)]         = PS2_KEY_NUM_7,
+  [KM_INDEX(HID_KEY_NUM_8)]         = PS2_KEY_NUM_8,
+  [KM_INDEX(HID_KEY_NUM_9)]         = PS2_KEY_NUM_9,
+  [KM_INDEX(HID_KEY_NUM_0)]         = PS2_KEY_NUM_0,
+  [KM_INDEX(HID_KEY_NUM_PERIOD)]    = PS2_KEY_NUM_PERIOD,
+  [KM_INDEX(HID_KEY_INT1)]          = PS2_KEY_INT1,
+  [KM_INDEX(HID_KEY_APPS)]          = PS2_KEY_APPS | KM_EXT,
+  [KM_INDEX(HID_KEY_LCTRL)]         = PS2_KEY_LCTRL,
+  [KM_INDEX(HID_KEY_LSHIFT)]        = PS2_KEY_LSHIFT,
+  [KM_INDEX(HID_KEY_ALT)]           = PS2_KEY_ALT,
+  [KM_INDEX(HID_KEY_LGUI)]          = PS2_KEY_LGUI | KM_EXT,
+  [KM_INDEX(HID_KEY_RCTRL)]         = PS2_KEY_RCTRL | KM_EXT,
+  [KM_INDEX(HID_KEY_RSHIFT)]        = PS2_KEY_RSHIFT,
+  [KM_INDEX(HID_KEY_RALT)]          = PS2_KEY_RALT | KM_EXT,
+  [KM_INDEX(HID_KEY_RGUI)]          = PS2_KEY_RGUI | KM_EXT,
+};
+
+static const uint8_t hid_xt[] PROGMEM = {
+  [KM_INDEX(HID_KEY_A)]             = XT_KEY_A,
+  [KM_INDEX(HID_KEY_B)]             = XT_KEY_B,
+  [KM_INDEX(HID_KEY_C)]             = XT_KEY_C,
+  [KM_INDEX(HID_KEY_D)]             = XT_KEY_D,
+  [KM_INDEX(HID_KEY_E)]             = XT_KEY_E,
+  [KM_INDEX(HID_KEY_F)]             = XT_KEY_F,
+  [KM_INDEX(HID_KEY_G)]             = XT_KEY_G,
+  [KM_INDEX(HID_KEY_H)]             = XT_KEY_H,
+  [KM_INDEX(HID_KEY_I)]             = XT_KEY_I,
+  [KM_INDEX(HID_KEY_J)]             = XT_KEY_J,
+  [KM_INDEX(HID_KEY_K)]             = XT_KEY_K,
+  [KM_INDEX(HID_KEY_L)]             = XT_KEY_L,
+  [KM_INDEX(HID_KEY_M)]             = XT_KEY_M,
+  [KM_INDEX(HID_KEY_N)]             = XT_KEY_N,
+  [KM_INDEX(HID_KEY_O)]             = XT_KEY_O,
+  [KM_INDEX(HID_KEY_P)]             = XT_KEY_P,
+  [KM_INDEX(HID_KEY_Q)]             = XT_KEY_Q,
+  [KM_INDEX(HID_KEY_R)]             = XT_KEY_R,
+  [KM_INDEX(HID_KEY_S)]             = XT_KEY_S,
+  [KM_INDEX(HID_KEY_T)]             = XT_KEY_T,
+  [KM_INDEX(HID_KEY_U)]             = XT_KEY_U,
+  [KM_INDEX(HID_KEY_V)]             = XT_KEY_V,
+  [KM_INDEX(HID_KEY_W)]             = XT_KEY_W,
+  [KM_INDEX(HID_KEY_X)]             = XT_KEY_X,
+  [KM_INDEX(HID_KEY_Y)]             = XT_KEY_Y,
+  [KM_INDEX(HID_KEY_Z)]             = XT_KEY_Z,
+  [KM_INDEX(HID_KEY_1)]             = XT_KEY_1,
+  [KM_INDEX(HID_KEY_2)]             = XT_KEY_2,
+  [KM_INDEX(HID_KEY_3)]             = XT_KEY_3,
+  [KM_INDEX(HID_KEY_4)]             = XT_KEY_4,
+  [KM_INDEX(HID_KEY_5)]             = XT_KEY_5,
+  [KM_INDEX(HID_KEY_6)]             = XT_KEY_6,
+  [KM_INDEX(HID_KEY_7)]             = XT_KEY_7,
+  [KM_INDEX(HID_KEY_8)]             = XT_KEY_8,
+  [KM_INDEX(HID_KEY_9)]             = XT_KEY_9,
+  [KM_INDEX(HID_KEY_0)]             = XT_KEY_0,
+  [KM_INDEX(HID_KEY_ENTER)]         = XT_KEY_ENTER,
+  [KM_INDEX(HID_KEY_ESC)]           = XT_KEY_ESC,
+  [KM_INDEX(HID_KEY_BS)]            = XT_KEY_BS,
+  [KM_INDEX(HID_KEY_TAB)]           = XT_KEY_TAB,
+  [KM_INDEX(HID_KEY_SPACE)]         = XT_KEY_SPACE,
+  [KM_INDEX(HID_KEY_MINUS)]         = XT_KEY_MINUS,
+  [KM_INDEX(HID_KEY_EQUALS)]        = XT_KEY_EQUALS,
+  [KM_INDEX(HID_KEY_LBRACKET)]      = XT_KEY_LBRACKET,
+  [KM_INDEX(HID_KEY_RBRACKET)]      = XT_KEY_RBRACKET,
+  [KM_INDEX(HID_KEY_BACKSLASH)]     = XT_KEY_BACKSLASH,
+  [KM_INDEX(HID_KEY_INT2)]          = XT_KEY_INT2,
+  [KM_INDEX(HID_KEY_SEMICOLON)]     = XT_KEY_SEMICOLON,
+  [KM_INDEX(HID_KEY_APOSTROPHE)]    = XT_KEY_APOSTROPHE,
+  [KM_INDEX(HID_KEY_BACKQUOTE)]     = XT_KEY_BACKQUOTE,
+  [KM_INDEX(HID_KEY_COMMA)]         = XT_KEY_COMMA,
+  [KM_INDEX(HID_KEY_PERIOD)]        = XT_KEY_PERIOD,
+  [KM_INDEX(HID_KEY_SLASH)]         = XT_KEY_SLASH,
+  [KM_INDEX(HID_KEY_CAPS_LOCK)]     = XT_KEY_CAPS_LOCK,
+  [KM_INDEX(HID_KEY_F1)]            = XT_KEY_F1,
+  [KM_INDEX(HID_KEY_F2)]            = XT_KEY_F2,
+  [KM_INDEX(HID_KEY_F3)]            = XT_KEY_F3,
+  [KM_INDEX(HID_KEY_F4)]            = XT_KEY_F4,
+  [KM_INDEX(HID_KEY_F5)]            = XT_KEY_F5,
+  [KM_INDEX(HID_KEY_F6)]            = XT_KEY_F6,
+  [KM_INDEX(HID_KEY_F7)]            = XT_KEY_F7,
+  [KM_INDEX(HID_KEY_F8)]            = XT_KEY_F8,
+  [KM_INDEX(HID_KEY_F9)]            = XT_KEY_F9,
+  [KM_INDEX(HID_KEY_F10)]           = XT_KEY_F10,
+  [KM_INDEX(HID_KEY_F11)]           = XT_KEY_F11,
+  [KM_INDEX(HID_KEY_F12)]           = XT_KEY_F12,
+  [KM_INDEX(HID_KEY_PRINT_SCREEN)]  = XT_KEY_PRINT_SCREEN | KM_EXT,
+  [KM_INDEX(HID_KEY_SCROLL_LOCK)]   = XT_KEY_SCROLL_LOCK,
+  [KM_INDEX(HID_KEY_INSERT)]        = XT_KEY_INSERT | KM_EXT,
+  [KM_INDEX(HID_KEY_HOME)]          = XT_KEY_HOME | KM_EXT,
+  [KM_INDEX(HID_KEY_PAGE_UP)]       = XT_KEY_PAGE_UP | KM_EXT,
+  [KM_INDEX(HID_KEY_DELETE)]        = XT_KEY_DELETE | KM_EXT,
+  [KM_INDEX(HID_KEY_END)]           = XT_KEY_END | KM_EXT,
+  [KM_INDEX(HID_KEY_PAGE_DOWN)]     = XT_KEY_PAGE_DOWN | KM_EXT,
+  [KM_INDEX(HID_KEY_CRSR_RIGHT)]    = XT_KEY_CRSR_RIGHT | KM_EXT,
+  [KM_INDEX(HID_KEY_CRSR_LEFT)]     = XT_KEY_CRSR_LEFT | KM_EXT,
+  [KM_INDEX(HID_KEY_CRSR_DOWN)]     = XT_KEY_CRSR_DOWN | KM_EXT,
+  [KM_INDEX(HID_KEY_CRSR_UP)]       = XT_KEY_CRSR_UP | KM_EXT,
+  [KM_INDEX(HID_KEY_NUM_LOCK)]      = XT_KEY_NUM_LOCK,
+  [KM_INDEX(HID_KEY_NUM_SLASH)]     = XT_KEY_NUM_SLASH | KM_EXT,
+  [KM_INDEX(HID_KEY_NUM_STAR)]      = XT_KEY_NUM_STAR,
+  [KM_INDEX(HID_KEY_NUM_MINUS)]     = XT_KEY_NUM_MINUS,
+  [KM_INDEX(HID_KEY_NUM_PLUS)]      = XT_KEY_NUM_PLUS,
+  [KM_INDEX(HID_KEY_NUM_ENTER)]     = XT_KEY_NUM_ENTER | KM_EXT,
+  [KM_INDEX(HID_KEY_NUM_1)]         = XT_KEY_NUM_1,
+  [KM_INDEX(HID_KEY_NUM_2)]         = XT_KEY_NUM_2,
+  [KM_INDEX(HID_KEY_NUM_3)]         = XT_KEY_NUM_3,
+  [KM_INDEX(HID_KEY_NUM_4)]         = XT_KEY_NUM_4,
+  [KM_INDEX(HID_KEY_NUM_5)]         = XT_KEY_NUM_5,
+  [KM_INDEX(HID_KEY_NUM_6)]         = XT_KEY_NUM_6,
+  [KM_INDEX(HID_KEY_NUM_7)]         = XT_KEY_NUM_7,
+  [KM_INDEX(HID_KEY_NUM_8)]         = XT_KEY_NUM_8,
+  [KM_INDEX(HID_KEY_NUM_9)]         = XT_KEY_NUM_9,
+  [KM_INDEX(HID_KEY_NUM_0)]         = XT_KEY_NUM_0,
+  [KM_INDEX(HID_KEY_NUM_PERIOD)]    = XT_KEY_NUM_PERIOD,
+  [KM_INDEX(HID_KEY_INT1)]          = XT_KEY_INT1,
+  [KM_INDEX(HID_KEY_APPS)]          = XT_KEY_APPS | KM_EXT,
+  [KM_INDEX(HID_KEY_LCTRL)]         = XT_KEY_LCTRL,
+  [KM_INDEX(HID_KEY_LSHIFT)]        = XT_KEY_LSHIFT,
+  [KM_INDEX(HID_KEY_ALT)]           = XT_KEY_ALT,
+  [KM_INDEX(HID_KEY_LGUI)]          = XT_KEY_LGUI | KM_EXT,
+  [KM_INDEX(HID_KEY_RCTRL)]         = XT_KEY_RCTRL | KM_EXT,
+  [KM_INDEX(HID_KEY_RSHIFT)]        = XT_KEY_RSHIFT,
+  [KM_INDEX(HID_KEY_RALT)]          = XT_KEY_RALT | KM_EXT,
+  [KM_INDEX(HID_KEY_RGUI)]          = XT_KEY_RGUI | KM_EXT,
+};
+
+// unshifted, shifted, control
+static const uint8_t hid_ascii[][3] PROGMEM = {
+  [HID_KEY_A]         = {'a', 'A', CTRL('a')},
+  [HID_KEY_B]         = {'b', 'B', CTRL('b')},
+  [HID_KEY_C]         = {'c', 'C', CTRL('c')},
+  [HID_KEY_D]         = {'d', 'D', CTRL('d')},
+  [HID_KEY_E]         = {'e', 'E', CTRL('e')},
+  [HID_KEY_F]         = {'f', 'F', CTRL('f')},
+  [HID_KEY_G]         = {'g', 'G', CTRL('g')},
+  [HID_KEY_H]         = {'h', 'H', CTRL('h')},
+  [HID_KEY_I]         = {'i', 'I', CTRL('i')},
+  [HID_KEY_J]         = {'j', 'J', CTRL('j')},
+  [HID_KEY_K]         = {'k', 'K', CTRL('k')},
+  [HID_KEY_L]         = {'l', 'L', CTRL('l')},
+  [HID_KEY_M]         = {'m', 'M', CTRL('m')},
+  [HID_KEY_N]         = {'n', 'N', CTRL('n')},
+  [HID_KEY_O]         = {'o', 'O', CTRL('o')},
+  [HID_KEY_P]         = {'p', 'P', CTRL('p')},
+  [HID_KEY_Q]         = {'q', 'Q', CTRL('q')},
+  [HID_KEY_R]         = {'r', 'R', CTRL('r')},
+  [HID_KEY_S]         = {'s', 'S', CTRL('s')},
+  [HID_KEY_T]         = {'t', 'T', CTRL('t')},
+  [HID_KEY_U]         = {'u', 'U', CTRL('u')},
+  [HID_KEY_V]         = {'v', 'V', CTRL('v')},
+  [HID_KEY_W]         = {'w', 'W', CTRL('w')},
+  [HID_KEY_X]         = {'x', 'X', CTRL('x')},
+  [HID_KEY_Y]         = {'y', 'Y', CTRL('y')},
+  [HID_KEY_Z]         = {'z', 'Z', CTRL('z')},
+  [HID_KEY_1]         = {'1', '!', 0},
+  [HID_KEY_2]         = {'2', '@', 0},
+  [HID_KEY_3]         = {'3', '#', 0},
+  [HID_KEY_4]         = {'4', '$', 0},
+  [HID_KEY_5]         = {'5', '%', 0},
+  [HID_KEY_6]         = {'6', '^', 0},
+  [HID_KEY_7]         = {'7', '&', 0},
+  [HID_KEY_8]         = {'8', '*', 0},
+  [HID_KEY_9]         = {'9', '(', 0},
+  [HID_KEY_0]         = {'0', ')', 0},
+  [HID_KEY_ENTER]     = {13, 13, 13},
+  [HID_KEY_ESC]       = {0x1b, 0x1b, 0x1b},
+  [HID_KEY_BS]        = {0x08, 0x08, 0x08},
+  [HID_KEY_TAB]       = {0x09, 0x09, 0x09},
+  [HID_KEY_SPACE]     = {' ', ' ', ' '},
+  [HID_KEY_MINUS]     = {'-', '_', CTRL('-')},
+  [HID_KEY_EQUALS]    = {'=', '+', 0},
+  [HID_KEY_LBRACKET]  = {'[', '{', 0},
+  [HID_KEY_RBRACKET]  = {']', '}', 0},
+  [HID_KEY_BACKSLASH] = {'\\', '|', CTRL('\\')},
+  [HID_KEY_SEMICOLON] = {';', ':', 0},
+  [HID_KEY_APOSTROPHE]= {'\'', '"', 0},
+  [HID_KEY_BACKQUOTE] = {'`', '~', 0},
+  [HID_KEY_COMMA]     = {',', '<', 0},
+  [HID_KEY_PERIOD]    = {'.', '>', 0},
+  [HID_KEY_SLASH]     = {'/', '?', 0},
+  [HID_KEY_NUM_SLASH] = {'/', '?', 0},
+  [HID_KEY_NUM_STAR]  = {'*', '*', 0},
+  [HID_KEY_NUM_MINUS] = {'-', '-', 0},
+  [HID_KEY_NUM_PLUS]  = {'+', '+', 0},
+  [HID_KEY_NUM_ENTER] = {13, 13, 13},
+  [HID_KEY_NUM_1]     = {'1', '1', 0},
+  [HID_KEY_NUM_2]     = {'2', '2', 0},
+  [HID_KEY_NUM_3]     = {'3', '3', 0},
+  [HID_KEY_NUM_4]     = {'4', '4', 0},
+  [HID_KEY_NUM_5]     = {'5', '5', 0},
+  [HID_KEY_NUM_6]     = {'6', '6', 0},
+  [HID_KEY_NUM_7]     = {'7', '7', 0},
+  [HID_KEY_NUM_8]     = {'8', '8', 0},
+  [HID_KEY_NUM_9]     = {'9', '9', 0},
+  [HID_KEY_NUM_0]     = {'0', '0', 0},
+  [HID_KEY_NUM_PERIOD]= {'.', '.', 0},
+};
+
+#ifdef MATRIX_SUPPORT
+/*
+ * Matrix layers, by row and column.  The base layer is a keypad, Fn
+ * turns it into an editing pad.  NONE in an upper layer falls through
+ * to the layer below.
+ */
+static const uint8_t mat_keymap[MAT_LAYERS][MAT_ROWS][MAT_COLS] PROGMEM = {
+  {
+    {HID_KEY_NUM_7,     HID_KEY_NUM_8,     HID_KEY_NUM_9,      HID_KEY_NUM_SLASH},
+    {HID_KEY_NUM_4,     HID_KEY_NUM_5,     HID_KEY_NUM_6,      HID_KEY_NUM_STAR},
+    {HID_KEY_NUM_1,     HID_KEY_NUM_2,     HID_KEY_NUM_3,      HID_KEY_NUM_MINUS},
+    {KM_FN(1),          HID_KEY_NUM_0,     HID_KEY_NUM_PERIOD, HID_KEY_NUM_ENTER},
+  },
+  {
+    {HID_KEY_HOME,      HID_KEY_CRSR_UP,   HID_KEY_PAGE_UP,    HID_KEY_NUM_LOCK},
+    {HID_KEY_CRSR_LEFT, HID_KEY_NONE,      HID_KEY_CRSR_RIGHT, HID_KEY_BS},
+    {HID_KEY_END,       HID_KEY_CRSR_DOWN, HID_KEY_PAGE_DOWN,  HID_KEY_NUM_PLUS},
+    {HID_KEY_NONE,      HID_KEY_INSERT,    HID_KEY_DELETE,     HID_KEY_ESC},
+  },
+};
+#endif
+
+/*
+ * Keys changed on the way through in passthrough mode, as {from, to}
+ * usages.  Site specific layouts go here.
+ */
+static const uint8_t hid_remap[][2] PROGMEM = {
+#ifdef KM_SWAP_CAPS_CTRL
+  {HID_KEY_CAPS_LOCK, HID_KEY_LCTRL},
+  {HID_KEY_LCTRL,     HID_KEY_CAPS_LOCK},
+#endif
+};
+
+static uint8_t km_lookup(const uint8_t *table, uint8_t size, uint8_t code) {
+  return (code < size ? pgm_read_byte(&table[code]) : HID_KEY_NONE);
+}
+
+static uint8_t km_search(const uint8_t (*table)[2], uint8_t size, uint8_t code) {
+  uint8_t i;
+
+  for(i = 0; i < size; i++) {
+    if(pgm_read_byte(&table[i][0]) == code)
+      return pgm_read_byte(&table[i][1]);
+  }
+  return HID_KEY_NONE;
+}
+
+uint8_t km_ps2_to_hid(uint8_t code) {
+  return km_lookup(ps2_set2, sizeof(ps2_set2), code);
+}
+
+uint8_t km_ps2_ext_to_hid(uint8_t code) {
+  return km_search(ps2_set2_ext, sizeof(ps2_set2_ext) / 2, code);
+}
+
+#ifdef PS2_SET3_SUPPORT
+uint8_t km_set3_to_hid(uint8_t code) {
+  return km_lookup(ps2_set3, sizeof(ps2_set3), code);
+}
+#endif
+
+uint8_t km_xt_to_hid(uint8_t code) {
+  return km_lookup(xt_set1, sizeof(xt_set1), code);
+}
+
+uint8_t km_xt_ext_to_hid(uint8_t code) {
+  return km_search(xt_set1_ext, sizeof(xt_set1_ext) / 2, code);
+}
+
+uint8_t km_hid_to_ps2(uint8_t hid) {
+  return km_lookup(hid_ps2, sizeof(hid_ps2), KM_INDEX(hid));
+}
+
+uint8_t km_hid_to_xt(uint8_t hid) {
+  return km_lookup(hid_xt, sizeof(hid_xt), KM_INDEX(hid));
+}
+
+uint8_t km_hid_to_ascii(uint8_t hid, kmascii_t col) {
+  if(hid >= sizeof(hid_ascii) / 3)
+    return 0;
+  return pgm_read_byte(&hid_ascii[hid][col]);
+}
+
+// returns hid itself if the remap table does not list it.
+uint8_t km_remap(uint8_t hid) {
+  uint8_t out = km_search(hid_remap, sizeof(hid_remap) / 2, hid);
+
+  return (out == HID_KEY_NONE ? hid : out);
+}
+
+#ifdef MATRIX_SUPPORT
+uint8_t km_matrix_to_hid(uint8_t code, uint8_t layer) {
+  uint8_t hid = HID_KEY_NONE;
+
+  if(code >= MAT_KEYS)
+    return HID_KEY_NONE;
+  layer++;
+  while(layer-- && hid == HID_KEY_NONE)
+    hid = pgm_read_byte(&mat_keymap[layer][code / MAT_COLS][code % MAT_COLS]);
+  return hid;
+}
+#endif
+
+void km_seq_init(kmseq_t *seq, kmseqset_t set) {
+  seq->start = (set == KM_SEQ_SET1 ? S1_IDLE : S2_IDLE);
+  seq->state = seq->start;
+}
+
+uint8_t km_seq_step(kmseq_t *seq, uint8_t code, uint8_t *hid) {
+  uint8_t i = seq->state;
+  uint8_t flags;
+  uint8_t out;
+
+  // every state ends in an SQ_ANY edge, so this always stops.
+  while(!((flags = pgm_read_byte(&seq_table[i][1])) & SQ_ANY)
+        && pgm_read_byte(&seq_table[i][0]) != code)
+    i++;
+  if(!(flags & SQ_EMIT)) {
+    seq->state = flags & SQ_STATE_MASK;
+    return KM_SEQ_NONE;
+  }
+  seq->state = seq->start;
+  out = pgm_read_byte(&seq_table[i][2]);
+  switch(out) {
+    case KM_DEC_PS2:
+      out = km_ps2_to_hid(code);
+      break;
+    case KM_DEC_PS2_EXT:
+      out = km_ps2_ext_to_hid(code);
+      break;
+    case KM_DEC_XT:
+      out = km_xt_to_hid(code & 0x7f);
+      break;
+    case KM_DEC_XT_EXT:
+      out = km_xt_ext_to_hid(code & 0x7f);
+      break;
+  }
+  *hid = out;
+  if(flags & SQ_SET1)
+    return (code & 0x80 ? KM_SEQ_UP : KM_SEQ_DOWN);
+  return flags & KM_SEQ_TAP;
+}
@@ -0,0 +1,85 @@
+/*
+    PS2Encoder - PS2 Keyboard to serial/parallel converter
+    Copyright Jim Brain and RETRO Innovations, 2008-2012
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+    keymap.h: public functions for scan code <-> HID usage translation
+
+*/
+
+#ifndef KEYMAP_H
+#define KEYMAP_H
+
+#include "hid.h"
+#include "ps2.h"
+
+// an encoded PS/2 or XT code with this set needs an E0 prefix.
+#define KM_EXT                0x80
+// PS2_KEY_F7 is the only set 2 code above 0x7f, and there is no E0 03.
+#define KM_PS2_IS_EXT(c)      (((c) & KM_EXT) && (c) != PS2_KEY_F7)
+#define KM_PS2_CODE(c)        (KM_PS2_IS_EXT(c) ? (c) & (uint8_t)~KM_EXT : (c))
+
+// encode tables hold the 0x00-0x65 usages, then the 8 modifiers.
+#define KM_NORMAL             (HID_KEY_APPS + 1)
+#define KM_INDEX(h)           ((h) >= HID_KEY_LCTRL ? (h) - HID_KEY_LCTRL + KM_NORMAL : (h))
+
+// km_seq_step() results, TAP is a keydown and keyup together.
+#define KM_SEQ_NONE           0
+#define KM_SEQ_DOWN           1
+#define KM_SEQ_UP             2
+#define KM_SEQ_TAP            (KM_SEQ_DOWN | KM_SEQ_UP)
+
+typedef enum {KM_SEQ_SET2 = 0
+             ,KM_SEQ_SET1
+             } kmseqset_t;
+
+typedef struct {
+  uint8_t start;
+  uint8_t state;
+} kmseq_t;
+
+#define km_seq_reset(s)       ((s)->state = (s)->start)
+
+// matrix keymap entries past the HID usages, Fn n selects layer n.
+#define KM_FN(n)              (0xf0 + (n))
+#define KM_IS_FN(h)           ((h) > KM_FN(0))
+#define KM_FN_LAYER(h)        ((h) - KM_FN(0))
+
+typedef enum {KM_ASCII_NORMAL = 0
+             ,KM_ASCII_SHIFT
+             ,KM_ASCII_CTRL
+             } kmascii_t;
+
+uint8_t km_ps2_to_hid(uint8_t code);
+uint8_t km_ps2_ext_to_hid(uint8_t code);
+#ifdef PS2_SET3_SUPPORT
+uint8_t km_set3_to_hid(uint8_t code);
+#endif
+uint8_t km_xt_to_hid(uint8_t code);
+uint8_t km_xt_ext_to_hid(uint8_t code);
+
+uint8_t km_hid_to_ps2(uint8_t hid);
+uint8_t km_hid_to_xt(uint8_t hid);
+uint8_t km_hid_to_ascii(uint8_t hid, kmascii_t col);
+uint8_t km_remap(uint8_t hid);
+#ifdef MATRIX_SUPPORT
+uint8_t km_matrix_to_hid(uint8_t code, uint8_t layer);
+#endif
+
+void km_seq_init(kmseq_t *seq, kmseqset_t set);
+uint8_t km_seq_step(kmseq_t *seq, uint8_t code, uint8_t *hid);
+
+#endif
@@ -21,30 +21,23 @@
 
 #include <inttypes.h>
 #include <avr/interrupt.h>
+#include <avr/sleep.h>
 #include <util/delay.h>
+#include "calibrate.h"
 #include "config.h"
 #include "eeprom.h"
+#include "event.h"
 #include "flags.h"
-//#include "matrix.h"
+#include "keymap.h"
+#include "matrix.h"
+#include "mouse.h"
+#include "parallel.h"
 #include "ps2.h"
 //#include "switches.h"
+#include "timer.h"
 #include "uart.h"
 #include "xt.h"
 
-typedef enum {
-              POLL_ST_IDLE,
-              POLL_ST_GET_X_KEY,
-              POLL_ST_GET_KEY_UP,
-              POLL_ST_GET_X_KEY_UP,
-              POLL_ST_GET_PAUSE_1,
-              POLL_ST_GET_PAUSE_2,
-              POLL_ST_GET_PAUSE_3,
-              POLL_ST_GET_PAUSE_4,
-              POLL_ST_GET_PAUSE_5,
-              POLL_ST_GET_PAUSE_6,
-              POLL_ST_GET_PAUSE_7
-             } poll_state_t;
-
 #define POLL_FLAG_LSHIFT      1
 #define POLL_FLAG_RSHIFT      2
 #define POLL_FLAG_SHIFT       (POLL_FLAG_LSHIFT | POLL_FLAG_RSHIFT)
@@ -54,13 +47,46 @@ typedef enum {
 #define POLL_FLAG_CAPS_LOCK   16
 #define POLL_FLAG_NUM_LOCK    32
 #define POLL_FLAG_SCROLL_LOCK 64
+#define POLL_FLAG_LOCKS       (POLL_FLAG_CAPS_LOCK | POLL_FLAG_NUM_LOCK | POLL_FLAG_SCROLL_LOCK)
 
 #define KB_CONFIG             1
 
+#define KB_PEND_LEDS          1
+#define KB_PEND_RATE          2
+#define KB_CMD_TIMEOUT        TIMER_MS(30)
+#define KB_CMD_RETRIES        3
+
+typedef enum {KB_ST_IDLE = 0
+             ,KB_ST_CMD
+             ,KB_ST_ARG
+             } kbstate_t;
+
+// command state for one keyboard
+typedef struct {
+  kbstate_t state;
+  uint8_t pending;
+  uint8_t cmd;
+  uint8_t arg;
+  uint8_t tries;
+  uint16_t sent;
+} kbctl_t;
+
+#ifdef PS2_KB_MERGE
+#  define KB_PORTS            2
+// bytes from both keyboards are taken in the order they arrived.
+#  define kb_next_port()      ps2_oldest_port()
+#else
+#  define KB_PORTS            1
+#  define kb_next_port()      (ps2_data_available() ? 0 : KB_PORTS)
+#endif
+
 static uint8_t meta;
 static uint8_t xt_eshift;
+// one bit per HID usage, set while the key is down.
+static uint8_t keys_down[256 / 8];
 static uint8_t config;
 static uint8_t led_state=0;
+static kbctl_t kb[KB_PORTS];
 uint8_t globalopts;
 uint8_t holdoff;
 uint8_t pulselen;
@@ -69,16 +95,19 @@ uint16_t uart_bps;
 uartlen_t uart_length;
 uartpar_t uart_parity;
 uartstop_t uart_stop;
+uartflow_t uart_flow;
+uint8_t uart_autobaud;
+uint8_t kb_type;
+uint8_t ps2_half;
+uint8_t ps2_gap;
+uint8_t ps2_adapt;
+uint8_t xt_timing;
+uint8_t xt_adapt;
+uint8_t ms_proto;
+uint8_t ms_rate;
 uint8_t  type_delay;
 uint8_t  type_rate;
 
-static inline __attribute__((always_inline)) void delay_strobe(uint8_t delay) {
-  uint8_t i;
-
-  for(i = 0; i < delay; i++)
-    _delay_us(1);
-}
-
 static inline __attribute__((always_inline)) void delay_reset(uint8_t delay) {
   uint8_t i;
 
@@ -86,22 +115,17 @@ static inline __attribute__((always_inline)) void delay_reset(uint8_t delay) {
     _delay_us(10);
 }
 
-static inline void send_raw(uint8_t key) {
-  // send via RS232
-  uart_putc(key);
-  data_out(key);
-  if(globalopts & OPT_STROBE_LO) {
-    data_strobe_lo();
-    delay_strobe(pulselen);
-    data_strobe_hi();
-  } else {
-    data_strobe_hi();
-    delay_strobe(pulselen);
-    data_strobe_lo();
-  }
-  key = holdoff;
-  while(key--)
-    _delay_us(10);
+static void send_raw(uint8_t key) {
+  // each channel queues and paces itself, so neither waits on the other.
+  // config mode replies go everywhere, so the user can always see them.
+  // a serial mouse owns the UART outside of config mode.
+  if(config || (!(globalopts & OPT_NO_UART) && !ms_serial()))
+    uart_putc(key);
+#ifndef MATRIX_SUPPORT
+  // the matrix has the parallel data pins.
+  if(config || !(globalopts & OPT_NO_PAR))
+    par_putc(key);
+#endif
 }
 
 static void sendhex(uint8_t val) {
@@ -111,219 +135,14 @@ static void sendhex(uint8_t val) {
   send_raw(v > 9 ? i - 10 + 'a':v + '0');
 }
 
-#define CTRL(x)    (x & 0x1f)
-#define MAP(x,y,z) do { u = x; s = y; c = z;} while(0)
+static void hid_to_ascii(uint8_t code) {
+  uint8_t u = km_hid_to_ascii(code, KM_ASCII_NORMAL);
+  uint8_t s = km_hid_to_ascii(code, KM_ASCII_SHIFT);
+  uint8_t c = km_hid_to_ascii(code, KM_ASCII_CTRL);
 
-static void ps2_to_ascii(uint8_t code) {
-  uint8_t u = 0,s = 0,c = 0;
-
-  // Yes, there are many more elegant ways of handling the mapping.  But, this is simple, and easy to rework.
-  switch(code) {
-    case PS2_KEY_TAB:
-      MAP(0x09,0x09,0x09);
-      break;
-    case PS2_KEY_BACKQUOTE:
-      MAP('`','~',0);
-      break;
-    case PS2_KEY_Q:
-      MAP('q','Q',CTRL('q'));
-      break;
-    case PS2_KEY_1:
-      MAP('1','!',0);
-      break;
-    case PS2_KEY_NUM_1:
-      MAP('1','1',0);
-      break;
-    case PS2_KEY_Z:
-      MAP('z','Z',CTRL('z'));
-      break;
-    case PS2_KEY_S:
-      MAP('s','S',CTRL('s'));
-      break;
-    case PS2_KEY_A:
-      MAP('a','A',CTRL('a'));
-      break;
-    case PS2_KEY_W:
-      MAP('w','W',CTRL('w'));
-      break;
-    case PS2_KEY_2:
-      MAP('2','@',0);
-      break;
-    case PS2_KEY_NUM_2:
-      MAP('2','2',0);
-      break;
-    case PS2_KEY_C:
-      MAP('c','C',CTRL('c'));
-      break;
-    case PS2_KEY_X:
-      MAP('x','X',CTRL('x'));
-      break;
-    case PS2_KEY_D:
-      MAP('d','D',CTRL('d'));
-      break;
-    case PS2_KEY_E:
-      MAP('e','E',CTRL('e'));
-      break;
-    case PS2_KEY_4:
-      MAP('4','$',0);
-      break;
-    case PS2_KEY_NUM_4:
-      MAP('4','4',0);
-      break;
-    case PS2_KEY_3:
-      MAP('3','#',0);
-      break;
-    case PS2_KEY_NUM_3:
-      MAP('3','3',0);
-      break;
-    case PS2_KEY_SPACE:
-      MAP(' ',' ',' ');
-      break;
-    case PS2_KEY_V:
-      MAP('v','V',CTRL('v'));
-      break;
-    case PS2_KEY_F:
-      MAP('f','F',CTRL('f'));
-      break;
-    case PS2_KEY_T:
-      MAP('t','T',CTRL('t'));
-      break;
-    case PS2_KEY_R:
-      MAP('r','R',CTRL('r'));
-      break;
-    case PS2_KEY_5:
-      MAP('5','%',0);
-      break;
-    case PS2_KEY_NUM_5:
-      MAP('5','5',0);
-      break;
-    case PS2_KEY_N:
-      MAP('n','N',CTRL('n'));
-      break;
-    case PS2_KEY_B:
-      MAP('b','B',CTRL('b'));
-      break;
-    case PS2_KEY_H:
-      MAP('h','H',CTRL('h'));
-      break;
-    case PS2_KEY_G:
-      MAP('g','G',CTRL('g'));
-      break;
-    case PS2_KEY_Y:
-      MAP('y','Y',CTRL('y'));
-      break;
-    case PS2_KEY_6:
-      MAP('6','^',0);
-      break;
-    case PS2_KEY_NUM_6:
-      MAP('6','6',0);
-      break;
-    case PS2_KEY_M:
-      MAP('m','M',CTRL('m'));
-      break;
-    case PS2_KEY_J:
-      MAP('j','J',CTRL('j'));
-      break;
-    case PS2_KEY_U:
-      MAP('u','U',CTRL('u'));
-      break;
-    case PS2_KEY_7:
-      MAP('7','&',0);
-      break;
-    case PS2_KEY_NUM_7:
-      MAP('7','7',0);
-      break;
-    case PS2_KEY_8:
-      MAP('8','*',0);
-      break;
-    case PS2_KEY_NUM_8:
-      MAP('8','8',0);
-      break;
-    case PS2_KEY_COMMA:
-      MAP(',','<',0);
-      break;
-    case PS2_KEY_K:
-      MAP('k','K',CTRL('k'));
-      break;
-    case PS2_KEY_I:
-      MAP('i','I',CTRL('i'));
-      break;
-    case PS2_KEY_O:
-      MAP('o','O',CTRL('o'));
-      break;
-    case PS2_KEY_0:
-      MAP('0',')',0);
-      break;
-    case PS2_KEY_NUM_0:
-      MAP('0','0',0);
-      break;
-    case PS2_KEY_9:
-      MAP('9','(',0);
-      break;
-    case PS2_KEY_NUM_9:
-      MAP('9','9',0);
-      break;
-    case PS2_KEY_PERIOD:
-      MAP('.','>',0);
-      break;
-    case PS2_KEY_NUM_PERIOD:
-      MAP('.','.',0);
-      break;
-    case PS2_KEY_NUM_PLUS:
-      MAP('+','+',0);
-      break;
-    case PS2_KEY_NUM_MINUS:
-      MAP('-','-',0);
-      break;
-    case PS2_KEY_NUM_STAR:
-      MAP('*','*',0);
-      break;
-    case PS2_KEY_SLASH:
-    case PS2_KEY_NUM_SLASH | 0x80:
-      MAP('/','?',0);
-      break;
-    case PS2_KEY_L:
-      MAP('l','L',CTRL('l'));
-      break;
-    case PS2_KEY_SEMICOLON:
-      MAP(';',':',0);
-      break;
-    case PS2_KEY_P:
-      MAP('p','P',CTRL('p'));
-      break;
-    case PS2_KEY_MINUS:
-      MAP('-','_',CTRL('-'));
-      break;
-    case PS2_KEY_APOSTROPHE:
-      MAP('\'','"',0);
-      break;
-    case PS2_KEY_LBRACKET:
-      MAP('[','{',0);
-      break;
-    case PS2_KEY_EQUALS:
-      MAP('=','+',0);
-      break;
-    case PS2_KEY_ENTER:
-    case PS2_KEY_NUM_ENTER | 0x80:
-      MAP(13,13,13);
-      break;
-    case PS2_KEY_RBRACKET:
-      MAP(']','}',0);
-      break;
-    case PS2_KEY_BACKSLASH:
-      MAP('\\','|',CTRL('\\'));
-      break;
-    case PS2_KEY_BS:
-      if(globalopts & OPT_BACKSPACE)
-        MAP(0x08,0x08,0x08);
-      else
-        MAP(0x7f,0x7f,0x7f);
-      break;
-    case PS2_KEY_ESC:
-      MAP(0x1b,0x1b,0x1b);
-      break;
+  if(code == HID_KEY_BS && !(globalopts & OPT_BACKSPACE))
+    u = s = c = 0x7f;
 
-  }
   if(meta & POLL_FLAG_CONTROL && c)
     u = c;
   else if((meta & POLL_FLAG_SHIFT) && s)
@@ -337,476 +156,86 @@ static void ps2_to_ascii(uint8_t code) {
     send_raw(10);
 }
 
-static void xt_to_ps2(uint8_t code) {
-  uint8_t keydown = (code & 0x80 ? FALSE : TRUE);
-  uint8_t key;
-  code = code & 0x7f;
-
-  if(!keydown)
-    ps2_putc(PS2_KEY_UP);
-  switch (code) {
-    case XT_KEY_F1:           key = PS2_KEY_F1;           break;
-    case XT_KEY_F2:           key = PS2_KEY_F2;           break;
-    case XT_KEY_F3:           key = PS2_KEY_F3;           break;
-    case XT_KEY_F4:           key = PS2_KEY_F4;           break;
-    case XT_KEY_F5:           key = PS2_KEY_F5;           break;
-    case XT_KEY_F6:           key = PS2_KEY_F6;           break;
-    case XT_KEY_F7:           key = PS2_KEY_F7;           break;
-    case XT_KEY_F8:           key = PS2_KEY_F8;           break;
-    case XT_KEY_F9:           key = PS2_KEY_F9;           break;
-    case XT_KEY_F10:          key = PS2_KEY_F10;          break;
-    case XT_KEY_F11:          key = PS2_KEY_F11;          break;
-    case XT_KEY_F12:          key = PS2_KEY_F12;          break;
-    case XT_KEY_TAB:          key = PS2_KEY_TAB;          break;
-    case XT_KEY_BACKQUOTE:    key = PS2_KEY_BACKQUOTE;    break;
-    case XT_KEY_Q:            key = PS2_KEY_Q;            break;
-    case XT_KEY_1:            key = PS2_KEY_1;            break;
-    case XT_KEY_Z:            key = PS2_KEY_Z;            break;
-    case XT_KEY_S:            key = PS2_KEY_S;            break;
-    case XT_KEY_A:            key = PS2_KEY_A;            break;
-    case XT_KEY_W:            key = PS2_KEY_W;            break;
-    case XT_KEY_2:            key = PS2_KEY_2;            break;
-    case XT_KEY_C:            key = PS2_KEY_C;            break;
-    case XT_KEY_X:            key = PS2_KEY_X;            break;
-    case XT_KEY_D:            key = PS2_KEY_D;            break;
-    case XT_KEY_E:            key = PS2_KEY_E;            break;
-    case XT_KEY_4:            key = PS2_KEY_4;            break;
-    case XT_KEY_3:            key = PS2_KEY_3;            break;
-    case XT_KEY_SPACE:        key = PS2_KEY_SPACE;        break;
-    case XT_KEY_V:            key = PS2_KEY_V;            break;
-    case XT_KEY_F:            key = PS2_KEY_F;            break;
-    case XT_KEY_T:            key = PS2_KEY_T;            break;
-    case XT_KEY_R:            key = PS2_KEY_R;            break;
-    case XT_KEY_5:            key = PS2_KEY_5;            break;
-    case XT_KEY_N:            key = PS2_KEY_N;            break;
-    case XT_KEY_B:            key = PS2_KEY_B;            break;
-    case XT_KEY_H:            key = PS2_KEY_H;            break;
-    case XT_KEY_G:            key = PS2_KEY_G;            break;
-    case XT_KEY_Y:            key = PS2_KEY_Y;            break;
-    case XT_KEY_6:            key = PS2_KEY_6;            break;
-    case XT_KEY_M:            key = PS2_KEY_M;            break;
-    case XT_KEY_J:            key = PS2_KEY_J;            break;
-    case XT_KEY_U:            key = PS2_KEY_U;            break;
-    case XT_KEY_7:            key = PS2_KEY_7;            break;
-    case XT_KEY_8:            key = PS2_KEY_8;            break;
-    case XT_KEY_COMMA:        key = PS2_KEY_COMMA;        break;
-    case XT_KEY_K:            key = PS2_KEY_K;            break;
-    case XT_KEY_I:            key = PS2_KEY_I;            break;
-    case XT_KEY_O:            key = PS2_KEY_O;            break;
-    case XT_KEY_0:            key = PS2_KEY_0;            break;
-    case XT_KEY_NUM_0:        key = PS2_KEY_NUM_0;        break;
-    case XT_KEY_9:            key = PS2_KEY_9;            break;
-    case XT_KEY_PERIOD:       key = PS2_KEY_PERIOD;       break;
-    case XT_KEY_NUM_PERIOD:   key = PS2_KEY_NUM_PERIOD;   break;
-    case XT_KEY_SLASH:        key = PS2_KEY_SLASH;        break;
-    case XT_KEY_L:            key = PS2_KEY_L;            break;
-    case XT_KEY_SEMICOLON:    key = PS2_KEY_SEMICOLON;    break;
-    case XT_KEY_P:            key = PS2_KEY_P;            break;
-    case XT_KEY_MINUS:        key = PS2_KEY_MINUS;        break;
-    case XT_KEY_APOSTROPHE:   key = PS2_KEY_APOSTROPHE;   break;
-    case XT_KEY_LBRACKET:     key = PS2_KEY_LBRACKET;     break;
-    case XT_KEY_EQUALS:       key = PS2_KEY_EQUALS;       break;
-    case XT_KEY_ENTER:        key = PS2_KEY_ENTER;        break;
-    case XT_KEY_RBRACKET:     key = PS2_KEY_RBRACKET;     break;
-    case XT_KEY_BACKSLASH:    key = PS2_KEY_BACKSLASH;    break;
-    case XT_KEY_BS:           key = PS2_KEY_BS;           break;
-    case XT_KEY_ESC:          key = PS2_KEY_ESC;          break;
-    case XT_KEY_CAPS_LOCK:    key = PS2_KEY_CAPS_LOCK;    break;
-    case XT_KEY_NUM_LOCK:     key = PS2_KEY_NUM_LOCK;     break;
-    case XT_KEY_SCROLL_LOCK:  key = PS2_KEY_SCROLL_LOCK;  break;
-    case XT_KEY_ALT:          key = PS2_KEY_ALT;          break;
-    case XT_KEY_LCTRL:        key = PS2_KEY_LCTRL;        break;
-    case XT_KEY_LSHIFT:       key = PS2_KEY_LSHIFT;       break;
-    case XT_KEY_RSHIFT:       key = PS2_KEY_RSHIFT;       break;
-    case XT_KEY_NUM_PLUS:     key = PS2_KEY_NUM_PLUS;     break;
-    case XT_KEY_NUM_MINUS:    key = PS2_KEY_NUM_MINUS;    break;
-    case XT_KEY_NUM_STAR:     key = PS2_KEY_NUM_STAR;     break;
-    case XT_KEY_INT1:         key = PS2_KEY_INT1;         break;
-    //case XT_KEY_INT2:         key = PS2_KEY_INT2;         break;
-    case XT_KEY_NUM_1:        key = PS2_KEY_NUM_1;        break;
-    case XT_KEY_NUM_2:        key = PS2_KEY_NUM_2;        break;
-    case XT_KEY_NUM_3:        key = PS2_KEY_NUM_3;        break;
-    case XT_KEY_NUM_4:        key = PS2_KEY_NUM_4;        break;
-    case XT_KEY_NUM_5:        key = PS2_KEY_NUM_5;        break;
-    case XT_KEY_NUM_6:        key = PS2_KEY_NUM_6;        break;
-    case XT_KEY_NUM_7:        key = PS2_KEY_NUM_7;        break;
-    case XT_KEY_NUM_8:        key = PS2_KEY_NUM_8;        break;
-    case XT_KEY_NUM_9:        key = PS2_KEY_NUM_9;        break;
-  }
-  ps2_putc(key);
-}
-
-static void ps2_to_xt(uint8_t code,uint8_t keydown) {
-  uint8_t key = 0;
+static void hid_to_xt(uint8_t code,uint8_t keydown) {
+  uint8_t key = km_hid_to_xt(code);
   uint8_t eshift = FALSE;
 
-
   if(keydown && xt_eshift) { // remove extended shift)
     xt_putc(XT_KEY_EXT);
     xt_putc(XT_KEY_LSHIFT | 0x80);
     xt_eshift = FALSE;
   }
 
-  // Yes, there are many more elegant ways of handling the mapping.  But, this is simple, and easy to rework.
-  switch(code) {
-    case PS2_KEY_F1:
-      key = XT_KEY_F1;
-      break;
-    case PS2_KEY_F2:
-      key = XT_KEY_F2;
-      break;
-    case PS2_KEY_F3:
-      key = XT_KEY_F3;
-      break;
-    case PS2_KEY_F4:
-      key = XT_KEY_F4;
-      break;
-    case PS2_KEY_F5:
-      key = XT_KEY_F5;
-      break;
-    case PS2_KEY_F6:
-      key = XT_KEY_F6;
-      break;
-    case PS2_KEY_F7:
-      key = XT_KEY_F7;
-      break;
-    case PS2_KEY_F8:
-      key = XT_KEY_F8;
-      break;
-    case PS2_KEY_F9:
-      key = XT_KEY_F9;
-      break;
-    case PS2_KEY_F10:
-      key = XT_KEY_F10;
-      break;
-    case PS2_KEY_F11:
-      key = XT_KEY_F11;
-      break;
-    case PS2_KEY_F12:
-      key = XT_KEY_F12;
-      break;
-    case PS2_KEY_TAB:
-      key = XT_KEY_TAB;
-      break;
-    case PS2_KEY_BACKQUOTE:
-      key = XT_KEY_BACKQUOTE;
-      break;
-    case PS2_KEY_Q:
-      key = XT_KEY_Q;
-      break;
-    case PS2_KEY_1:
-      key = XT_KEY_1;
-      break;
-    case PS2_KEY_Z:
-      key = XT_KEY_Z;
-      break;
-    case PS2_KEY_S:
-      key = XT_KEY_S;
-      break;
-    case PS2_KEY_A:
-      key = XT_KEY_A;
-      break;
-    case PS2_KEY_W:
-      key = XT_KEY_W;
-      break;
-    case PS2_KEY_2:
-      key = XT_KEY_2;
-      break;
-    case PS2_KEY_C:
-      key = XT_KEY_C;
-      break;
-    case PS2_KEY_X:
-      key = XT_KEY_X;
-      break;
-    case PS2_KEY_D:
-      key = XT_KEY_D;
-      break;
-    case PS2_KEY_E:
-      key = XT_KEY_E;
-      break;
-    case PS2_KEY_4:
-      key = XT_KEY_4;
-      break;
-    case PS2_KEY_3:
-      key = XT_KEY_3;
-      break;
-    case PS2_KEY_SPACE:
-      key = XT_KEY_SPACE;
-      break;
-    case PS2_KEY_V:
-      key = XT_KEY_V;
-      break;
-    case PS2_KEY_F:
-      key = XT_KEY_F;
-      break;
-    case PS2_KEY_T:
-      key = XT_KEY_T;
-      break;
-    case PS2_KEY_R:
-      key = XT_KEY_R;
-      break;
-    case PS2_KEY_5:
-      key = XT_KEY_5;
-      break;
-    case PS2_KEY_N:
-      key = XT_KEY_N;
-      break;
-    case PS2_KEY_B:
-      key = XT_KEY_B;
-      break;
-    case PS2_KEY_H:
-      key = XT_KEY_H;
-      break;
-    case PS2_KEY_G:
-      key = XT_KEY_G;
-      break;
-    case PS2_KEY_Y:
-      key = XT_KEY_Y;
-      break;
-    case PS2_KEY_6:
-      key = XT_KEY_6;
-      break;
-    case PS2_KEY_M:
-      key = XT_KEY_M;
-      break;
-    case PS2_KEY_J:
-      key = XT_KEY_J;
-      break;
-    case PS2_KEY_U:
-      key = XT_KEY_U;
-      break;
-    case PS2_KEY_7:
-      key = XT_KEY_7;
-      break;
-    case PS2_KEY_8:
-      key = XT_KEY_8;
-      break;
-    case PS2_KEY_COMMA:
-      key = XT_KEY_COMMA;
-      break;
-    case PS2_KEY_K:
-      key = XT_KEY_K;
-      break;
-    case PS2_KEY_I:
-      key = XT_KEY_I;
-      break;
-    case PS2_KEY_O:
-      key = XT_KEY_O;
-      break;
-    case PS2_KEY_0:
-      key = XT_KEY_0;
-      break;
-    case PS2_KEY_NUM_0:
-      key = XT_KEY_NUM_0;
-      break;
-    case PS2_KEY_9:
-      key = XT_KEY_9;
-      break;
-    case PS2_KEY_PERIOD:
-      key = XT_KEY_PERIOD;
-      break;
-    case PS2_KEY_NUM_PERIOD:
-      key = XT_KEY_NUM_PERIOD;
-      break;
-    case PS2_KEY_SLASH:
-      key = XT_KEY_SLASH;
-      break;
-    case PS2_KEY_L:
-      key = XT_KEY_L;
-      break;
-    case PS2_KEY_SEMICOLON:
-      key = XT_KEY_SEMICOLON;
-      break;
-    case PS2_KEY_P:
-      key = XT_KEY_P;
-      break;
-    case PS2_KEY_MINUS:
-      key = XT_KEY_MINUS;
-      break;
-    case PS2_KEY_APOSTROPHE:
-      key = XT_KEY_APOSTROPHE;
-      break;
-    case PS2_KEY_LBRACKET:
-      key = XT_KEY_LBRACKET;
-      break;
-    case PS2_KEY_EQUALS:
-      key = XT_KEY_EQUALS;
-      break;
-    case PS2_KEY_ENTER:
-      key = XT_KEY_ENTER;
-      break;
-    case PS2_KEY_RBRACKET:
-      key = XT_KEY_RBRACKET;
-      break;
-    case PS2_KEY_BACKSLASH:
-      key = XT_KEY_BACKSLASH;
-      break;
-    case PS2_KEY_BS:
-      key = XT_KEY_BS;
-      break;
-    case PS2_KEY_ESC:
-      key = XT_KEY_ESC;
-      break;
-    case PS2_KEY_CAPS_LOCK:
-      key = XT_KEY_CAPS_LOCK;
-      break;
-    case PS2_KEY_NUM_LOCK:
-      key = XT_KEY_NUM_LOCK;
-      break;
-    case PS2_KEY_SCROLL_LOCK:
-      key = XT_KEY_SCROLL_LOCK;
-      break;
-    case PS2_KEY_ALT:
-      key = XT_KEY_ALT;
-      break;
-    case PS2_KEY_LCTRL:
-      key = XT_KEY_LCTRL;
-      break;
-    case PS2_KEY_LSHIFT:
-      key = XT_KEY_LSHIFT;
-      break;
-    case PS2_KEY_RSHIFT:
-      key = XT_KEY_RSHIFT;
-      break;
-    case PS2_KEY_NUM_PLUS:
-      key = XT_KEY_NUM_PLUS;
-      break;
-    case PS2_KEY_NUM_MINUS:
-      key = XT_KEY_NUM_MINUS;
-      break;
-    case PS2_KEY_NUM_STAR:
-      key = XT_KEY_NUM_STAR;
-      break;
-    case PS2_KEY_INT1:
-      key = XT_KEY_INT1;
-      break;
-    case PS2_KEY_INT2:
-      key = XT_KEY_INT2;
-      break;
-    case PS2_KEY_NUM_1:
-      key = XT_KEY_NUM_1;
-      break;
-    case PS2_KEY_NUM_2:
-      key = XT_KEY_NUM_2;
-      break;
-    case PS2_KEY_NUM_3:
-      key = XT_KEY_NUM_3;
-      break;
-    case PS2_KEY_NUM_4:
-      key = XT_KEY_NUM_4;
-      break;
-    case PS2_KEY_NUM_5:
-      key = XT_KEY_NUM_5;
-      break;
-    case PS2_KEY_NUM_6:
-      key = XT_KEY_NUM_6;
-      break;
-    case PS2_KEY_NUM_7:
-      key = XT_KEY_NUM_7;
-      break;
-    case PS2_KEY_NUM_8:
-      key = XT_KEY_NUM_8;
-      break;
-    case PS2_KEY_NUM_9:
-      key = XT_KEY_NUM_9;
-      break;
-  }
-  if(key) {
-    xt_putc(keydown ? key : key | 0x80);
-  } else {
-    // check for extended keys
-    switch (code) {
-      case PS2_KEY_RALT | 0x80:
-        key = XT_KEY_RALT;
-        break;
-      case PS2_KEY_RCTRL | 0x80:
-        key = XT_KEY_RCTRL;
-        break;
-      case PS2_KEY_NUM_ENTER | 0x80:
-        key = XT_KEY_NUM_ENTER;
-        break;
-      case PS2_KEY_NUM_SLASH | 0x80:
-        key = XT_KEY_NUM_SLASH;
-        break;
+  if(code == HID_KEY_PAUSE) {
+    if(keydown) {
+      xt_putc(XT_KEY_EXT_2);
+      xt_putc(XT_KEY_LCTRL);
+      xt_putc(XT_KEY_PAUSE);
+
+      xt_putc(XT_KEY_EXT_2);
+      xt_putc(XT_KEY_LCTRL | 0x80);
+      xt_putc(XT_KEY_PAUSE | 0x80);
     }
-    if(key) {
-      // send extended key
+  } else if(key & KM_EXT) {
+    key &= (uint8_t)~KM_EXT;
+    // codes that are sent with conditional extended shift:
+    if(code == HID_KEY_PRINT_SCREEN)
+      eshift = TRUE;
+    else if(code >= HID_KEY_INSERT && code <= HID_KEY_CRSR_UP)
+      eshift = (meta & POLL_FLAG_NUM_LOCK);
+    if(eshift && keydown && !(meta & POLL_FLAG_SHIFT)) {
+      // On keydown, put extended shift keydown first.
       xt_putc(XT_KEY_EXT);
-      xt_putc(keydown ? key : key | 0x80);
-    } else {
-      // codes that are sent with conditional extended shift:
-      switch(code) {
-        case PS2_KEY_END | 0x80:
-          key = XT_KEY_END;
-          eshift = (meta & POLL_FLAG_NUM_LOCK);
-          break;
-        case PS2_KEY_HOME | 0x80:
-          key = XT_KEY_HOME;
-          eshift = (meta & POLL_FLAG_NUM_LOCK);
-          break;
-        case PS2_KEY_INSERT | 0x80:
-          key = XT_KEY_INSERT;
-          eshift = (meta & POLL_FLAG_NUM_LOCK);
-          break;
-        case PS2_KEY_DELETE | 0x80:
-          key = XT_KEY_DELETE;
-          eshift = (meta & POLL_FLAG_NUM_LOCK);
-          break;
-        case PS2_KEY_PAGE_DOWN | 0x80:
-          key = XT_KEY_PAGE_DOWN;
-          eshift = (meta & POLL_FLAG_NUM_LOCK);
-          break;
-        case PS2_KEY_PAGE_UP | 0x80:
-          key = XT_KEY_PAGE_UP;
-          eshift = (meta & POLL_FLAG_NUM_LOCK);
-          break;
-        case PS2_KEY_CRSR_DOWN | 0x80:
-          key = XT_KEY_CRSR_DOWN;
-          eshift = (meta & POLL_FLAG_NUM_LOCK);
-          break;
-        case PS2_KEY_CRSR_RIGHT | 0x80:
-          key = XT_KEY_CRSR_RIGHT;
-          eshift = (meta & POLL_FLAG_NUM_LOCK);
-          break;
-        case PS2_KEY_CRSR_UP | 0x80:
-          key = XT_KEY_CRSR_UP;
-          eshift = (meta & POLL_FLAG_NUM_LOCK);
-          break;
-        case PS2_KEY_CRSR_LEFT | 0x80:
-          key = XT_KEY_CRSR_LEFT;
-          eshift = (meta & POLL_FLAG_NUM_LOCK);
-          break;
-        case PS2_KEY_PRINT_SCREEN | 0x80:
-          key = XT_KEY_PRINT_SCREEN;
-          eshift = TRUE;
-      }
-      if(key) {
-        if(eshift && keydown && !(meta & POLL_FLAG_SHIFT)) {
-          // On keydown, put extended shift keydown first.
-          xt_putc(XT_KEY_EXT);
-          xt_putc(XT_KEY_LSHIFT);
-          xt_eshift = TRUE;
-        }
-        // send extended key
-        xt_putc(XT_KEY_EXT);
-        xt_putc(keydown ? key : key | 0x80);
-        if(eshift && !keydown && !(meta & POLL_FLAG_SHIFT)) {
-          // on keyup, put extended shift keyup last.
-          // even if we've already put key up on E Shift, do it again.
-          xt_putc(XT_KEY_EXT);
-          xt_putc(XT_KEY_LSHIFT | 0x80);
-          xt_eshift = FALSE;
-        }
-      } else if(code == (XT_KEY_PAUSE | 0x80) && keydown) {
-        xt_putc(XT_KEY_EXT_2);
-        xt_putc(XT_KEY_LCTRL);
-        xt_putc(XT_KEY_PAUSE);
-
-        xt_putc(XT_KEY_EXT_2);
-        xt_putc(XT_KEY_LCTRL | 0x80);
-        xt_putc(XT_KEY_PAUSE | 0x80);
-      }
+      xt_putc(XT_KEY_LSHIFT);
+      xt_eshift = TRUE;
     }
+    // send extended key
+    xt_putc(XT_KEY_EXT);
+    xt_putc(keydown ? key : key | 0x80);
+    if(eshift && !keydown && !(meta & POLL_FLAG_SHIFT)) {
+      // on keyup, put extended shift keyup last.
+      // even if we've already put key up on E Shift, do it again.
+      xt_putc(XT_KEY_EXT);
+      xt_putc(XT_KEY_LSHIFT | 0x80);
+      xt_eshift = FALSE;
+    }
+  } else if(key) {
+    xt_putc(keydown ? key : key | 0x80);
+  }
+}
+
+static void hid_to_ps2(uint8_t code, uint8_t keydown) {
+  uint8_t key = km_hid_to_ps2(code);
+
+  if(code == HID_KEY_PAUSE) {
+    // Pause has no break code, the whole sequence goes out on keydown.
+    if(keydown) {
+      ps2_putc(PS2_KEY_EXT_2);
+      ps2_putc(PS2_KEY_PCTRL);
+      ps2_putc(PS2_KEY_PAUSE);
+      ps2_putc(PS2_KEY_EXT_2);
+      ps2_putc(PS2_KEY_UP);
+      ps2_putc(PS2_KEY_PCTRL);
+      ps2_putc(PS2_KEY_UP);
+      ps2_putc(PS2_KEY_PAUSE);
+    }
+    return;
+  }
+  if(code == HID_KEY_PRINT_SCREEN && keydown) {
+    ps2_putc(PS2_KEY_EXT);
+    ps2_putc(PS2_KEY_ECTRL);
+  }
+  if(key) {
+    if(KM_PS2_IS_EXT(key))
+      ps2_putc(PS2_KEY_EXT);
+    if(!keydown)
+      ps2_putc(PS2_KEY_UP);
+    ps2_putc(KM_PS2_CODE(key));
+  }
+  if(code == HID_KEY_PRINT_SCREEN && !keydown) {
+    ps2_putc(PS2_KEY_EXT);
+    ps2_putc(PS2_KEY_UP);
+    ps2_putc(PS2_KEY_ECTRL);
   }
 }
 
@@ -814,185 +243,384 @@ static void send_option(uint8_t ch, uint8_t b) {
   send_raw(b ? ch : '!');
 }
 
+static void set_bps(uint16_t bps, uint8_t error, uint8_t ch) {
+  // the divisor does not fit UBRR, or is too far off, keep the old rate.
+  if(error > BPS_MAX_ERROR) {
+    send_option(ch, FALSE);
+    return;
+  }
+  uart_bps = bps;
+  send_raw(ch);
+  // report rate error as " x.y%"
+  send_raw(' ');
+  if(error >= 100)
+    send_raw('0' + error / 100);
+  send_raw('0' + (error / 10) % 10);
+  send_raw('.');
+  send_raw('0' + error % 10);
+  send_raw('%');
+}
+
+// config mode always talks in the user's format, so it can be read.
+static void uart_setup(void) {
+  cal_autobaud_stop();
+  if(ms_serial() && !config) {
+    ms_uart_config();
+  } else {
+    uart_config(uart_bps, uart_length, uart_parity, uart_stop);
+    // a config saved with both the bridge and XON/XOFF keeps the bridge.
+    if(uart_flow == FLOW_XON_XOFF && (globalopts & OPT_BRIDGE))
+      uart_set_flow(FLOW_NONE);
+    else
+      uart_set_flow(uart_flow);
+  }
+}
+
+// framing errors mean the host moved to another rate.
+static uint8_t autobaud_wanted(void) {
+  return (uart_autobaud && !config && !ms_serial() && uart_rx_error_pending());
+}
+
+static uint8_t autobaud_events(void) {
+  return (cal_autobaud_busy() ? cal_autobaud_ready() : autobaud_wanted());
+}
+
+static void check_autobaud(void) {
+  uint16_t bps;
+
+  if(cal_autobaud_busy()) {
+    // timed in the background, this only looks at the result.
+    bps = cal_autobaud_task();
+    if(bps) {
+      uart_bps = bps;
+      eeprom_write_config();
+    }
+  } else if(autobaud_wanted()) {
+    uart_rx_errors();
+    cal_autobaud_start();
+  }
+}
+
 static void set_options(uint8_t key) {
   if(meta & POLL_FLAG_SHIFT) {
     switch(key) {
-    case PS2_KEY_ENTER:
+    case HID_KEY_ENTER:
       globalopts |= OPT_CRLF;
       send_raw('c');
       send_raw('l');
       break;
-    case PS2_KEY_1:       // 1 stop bit
+    case HID_KEY_1:       // 1 stop bit
       uart_stop = STOP_0;
       send_raw('s');
       send_raw('1');
       break;
-    case PS2_KEY_2:       // 2 stop bits
+    case HID_KEY_2:       // 2 stop bits
       uart_stop = STOP_1;
       send_raw('s');
       send_raw('2');
       break;
-    case PS2_KEY_7:       // 7 bit length
+    case HID_KEY_7:       // 7 bit length
       uart_length = LENGTH_7;
       send_raw('l');
       send_raw('7');
       break;
-    case PS2_KEY_8:       // 8 bit length
+    case HID_KEY_8:       // 8 bit length
       uart_length = LENGTH_8;
       send_raw('l');
       send_raw('8');
       break;
-    case PS2_KEY_P:       // Increase strobe pulse length
+    case HID_KEY_3:       // 76800 bps
+      set_bps(CALC_BPS(76800), CALC_BPS_ERROR(76800), '#');
+      break;
+    case HID_KEY_4:       // 115200 bps
+      set_bps(CALC_BPS(115200), CALC_BPS_ERROR(115200), '$');
+      break;
+    case HID_KEY_5:       // 230400 bps
+      set_bps(CALC_BPS(230400), CALC_BPS_ERROR(230400), '%');
+      break;
+    case HID_KEY_P:       // Increase strobe pulse length
       if(pulselen < 0xff)
         pulselen++;
       send_option('P',pulselen < 0xff);
       break;
-    case PS2_KEY_I:       // Increase reset pulse length
+    case HID_KEY_I:       // Increase reset pulse length
       if(resetlen < 0xff)
         resetlen++;
       send_option('I',resetlen < 0xff);
       break;
-    case PS2_KEY_T:       // Increase send delay
+    case HID_KEY_T:       // Increase send delay
       if(holdoff < 0xff)
         holdoff++;
       send_option('T',holdoff < 0xff);
       break;
-    case PS2_KEY_R:       // Increase Typematic rate
+    case HID_KEY_G:       // Slow down device mode PS/2 clock
+      if(ps2_half < PS2_HALF_CYCLE_MAX)
+        ps2_half++;
+      send_option('G',ps2_half < PS2_HALF_CYCLE_MAX);
+      break;
+    case HID_KEY_J:       // Increase device mode PS/2 byte gap
+      if(ps2_gap < 0xff)
+        ps2_gap++;
+      send_option('J',ps2_gap < 0xff);
+      break;
+    case HID_KEY_V:   // tune the PS/2 byte gap to the host
+      ps2_adapt = TRUE;
+      send_raw('V');
+      break;
+    case HID_KEY_M:   // next XT output timing profile
+      if(++xt_timing >= XT_TIMING_COUNT)
+        xt_timing = XT_TIMING_5150;
+      xt_set_timing(xt_timing, xt_adapt);
+      send_raw('M');
+      send_raw('0' + xt_timing);
+      break;
+    case HID_KEY_Y:   // tune the XT character gap to the host
+      xt_adapt = TRUE;
+      xt_set_timing(xt_timing, xt_adapt);
+      send_raw('Y');
+      break;
+    case HID_KEY_R:       // Increase Typematic rate
       if(type_rate < 0x1f)
         type_rate++;
       send_option('R',type_rate < 0x1f);
       break;
-    case PS2_KEY_D:       // Increase Typematic delay
+    case HID_KEY_D:       // Increase Typematic delay
       if(type_delay < 0x03)
         type_delay++;
       send_option('D',type_delay < 0x03);
       break;
-    case PS2_KEY_S:       // Increase OSCCAL
+    case HID_KEY_S:       // Increase OSCCAL
       if(OSCCAL < 0xff)
         OSCCAL++;
       send_option('+',OSCCAL < 0xff);
       break;
-    case PS2_KEY_L:   // LOW RESET STROBE
+    case HID_KEY_L:   // LOW RESET STROBE
       globalopts &= (uint8_t)~OPT_RESET_HI;
       reset_set_hi();
       send_raw('L');
       break;
-    case PS2_KEY_H:   // HI RESET STROBE
+    case HID_KEY_H:   // HI RESET STROBE
       globalopts |= OPT_RESET_HI;
       reset_set_lo();
       send_raw('H');
       break;
+#ifdef BRIDGE_SUPPORT
+    case HID_KEY_B:   // UART to parallel bridge on
+      // XON/XOFF would eat 0x11 and 0x13 out of the bridged data.
+      if(uart_flow != FLOW_XON_XOFF)
+        globalopts |= OPT_BRIDGE;
+      send_option('B', uart_flow != FLOW_XON_XOFF);
+      break;
+#endif
+#ifdef PS2_MOUSE_SUPPORT
+    case HID_KEY_O:   // next serial mouse protocol
+      if(++ms_proto >= MS_PROTO_COUNT)
+        ms_proto = MS_PROTO_OFF;
+      ms_restart();
+      send_raw('O');
+      send_raw('0' + ms_proto);
+      break;
+    case HID_KEY_E:   // next mouse sample rate
+      if(++ms_rate >= MS_RATE_COUNT)
+        ms_rate = MS_RATE_10;
+      ms_restart();
+      send_raw('E');
+      send_raw('0' + ms_rate);
+      break;
+#endif
+#ifdef PAR_BUSY_SUPPORT
+    case HID_KEY_A:   // wait for BUSY to clear before strobing
+      globalopts |= OPT_HANDSHAKE;
+      send_raw('A');
+      break;
+#endif
+    case HID_KEY_F:   // RTS/CTS flow control
+      uart_flow = FLOW_RTS_CTS;
+      send_raw('F');
+      break;
+#ifdef UART_AUTOBAUD_SUPPORT
+    case HID_KEY_Z:   // follow the host's bit rate
+      uart_autobaud = TRUE;
+      send_raw('Z');
+      break;
+#endif
+    case HID_KEY_X:   // XON/XOFF flow control, not while bridging
+      if(!(globalopts & OPT_BRIDGE))
+        uart_flow = FLOW_XON_XOFF;
+      send_option('X', !(globalopts & OPT_BRIDGE));
+      break;
+    case HID_KEY_U:   // UART output on
+      globalopts &= (uint8_t)~OPT_NO_UART;
+      send_raw('U');
+      break;
+    case HID_KEY_C:   // parallel output on
+      globalopts &= (uint8_t)~OPT_NO_PAR;
+      send_raw('C');
+      break;
     }
   } else {
     switch(key) {
-    case PS2_KEY_ENTER:
+    case HID_KEY_ENTER:
         globalopts &= (uint8_t)~OPT_CRLF;
         send_raw('c');
         send_raw('r');
       break;
-    case PS2_KEY_P:       // Increase strobe pulse length
+    case HID_KEY_P:       // Increase strobe pulse length
       if(pulselen)
         pulselen--;
       send_option('p',pulselen);
       break;
-    case PS2_KEY_I:       // Increase reset pulse length
+    case HID_KEY_I:       // Increase reset pulse length
       if(resetlen)
         resetlen--;
       send_option('i',resetlen);
       break;
-    case PS2_KEY_T:
+    case HID_KEY_T:
       if(holdoff)
         holdoff--;
       send_option('t',holdoff);
       break;
-    case PS2_KEY_R:       // Decrease Typematic rate
+    case HID_KEY_G:       // Speed up device mode PS/2 clock
+      if(ps2_half > PS2_HALF_CYCLE_MIN)
+        ps2_half--;
+      send_option('g',ps2_half > PS2_HALF_CYCLE_MIN);
+      break;
+    case HID_KEY_J:       // Decrease device mode PS/2 byte gap
+      if(ps2_gap > PS2_SEND_HOLDOFF_MIN)
+        ps2_gap--;
+      send_option('j',ps2_gap > PS2_SEND_HOLDOFF_MIN);
+      break;
+    case HID_KEY_V:   // fixed PS/2 byte gap
+      ps2_adapt = FALSE;
+      send_raw('v');
+      break;
+    case HID_KEY_M:   // genuine 5150 XT output timing
+      xt_timing = XT_TIMING_5150;
+      xt_set_timing(xt_timing, xt_adapt);
+      send_raw('m');
+      break;
+    case HID_KEY_Y:   // fixed XT character gap
+      xt_adapt = FALSE;
+      xt_set_timing(xt_timing, xt_adapt);
+      send_raw('y');
+      break;
+    case HID_KEY_R:       // Decrease Typematic rate
       if(type_rate)
         type_rate--;
       send_option('r',type_rate);
       break;
-    case PS2_KEY_D:  // Decrease typematic delay
+    case HID_KEY_D:  // Decrease typematic delay
       if(type_delay)
         type_delay--;
       send_option('d',type_delay <= 0x03);
       break;
-    case PS2_KEY_S:       // Decrease OSCCAL
+    case HID_KEY_S:       // Decrease OSCCAL
       if(OSCCAL)
         OSCCAL--;
       send_option('-',OSCCAL);
       break;
-    case PS2_KEY_L:   // LOW STROBE
+    case HID_KEY_K:       // Calibrate OSCCAL against a stream of 'U' from the host
+      send_raw('k');
+      if(cal_osccal(uart_bps)) {
+        eeprom_write_config();
+        sendhex(OSCCAL);
+      } else {
+        send_raw('!');
+      }
+      break;
+    case HID_KEY_L:   // LOW STROBE
       globalopts |= OPT_STROBE_LO;
       data_strobe_hi();
       send_raw('l');
       break;
-    case PS2_KEY_H:   // HI STROBE
+    case HID_KEY_H:   // HI STROBE
       globalopts &= (uint8_t)~OPT_STROBE_LO;
       data_strobe_lo();
       send_raw('h');
       break;
-    case PS2_KEY_0:   // 110 bps
-      uart_bps = CALC_BPS(110);
-      send_raw('0');
+    case HID_KEY_0:   // 110 bps
+      set_bps(CALC_BPS(110), CALC_BPS_ERROR(110), '0');
       break;
-    case PS2_KEY_1:   // 300 bps
-      uart_bps = CALC_BPS(300);
-      send_raw('1');
+    case HID_KEY_1:   // 300 bps
+      set_bps(CALC_BPS(300), CALC_BPS_ERROR(300), '1');
       break;
-    case PS2_KEY_2:   // 600 bps
-      uart_bps = CALC_BPS(600);
-      send_raw('2');
+    case HID_KEY_2:   // 600 bps
+      set_bps(CALC_BPS(600), CALC_BPS_ERROR(600), '2');
       break;
-    case PS2_KEY_3:   // 1200 bps
-      uart_bps = CALC_BPS(1200);
-      send_raw('3');
+    case HID_KEY_3:   // 1200 bps
+      set_bps(CALC_BPS(1200), CALC_BPS_ERROR(1200), '3');
       break;
-    case PS2_KEY_4:   // 2400 bps
-      uart_bps = CALC_BPS(2400);
-      send_raw('4');
+    case HID_KEY_4:   // 2400 bps
+      set_bps(CALC_BPS(2400), CALC_BPS_ERROR(2400), '4');
       break;
-    case PS2_KEY_5:   // 4800 bps
-      uart_bps = CALC_BPS(4800);
-      send_raw('5');
+    case HID_KEY_5:   // 4800 bps
+      set_bps(CALC_BPS(4800), CALC_BPS_ERROR(4800), '5');
       break;
-    case PS2_KEY_6:   // 9600 bps
-      uart_bps = CALC_BPS(9600);
-      send_raw('6');
+    case HID_KEY_6:   // 9600 bps
+      set_bps(CALC_BPS(9600), CALC_BPS_ERROR(9600), '6');
       break;
-    case PS2_KEY_7:   // 19200 bps
-      uart_bps = CALC_BPS(19200);
-      send_raw('7');
+    case HID_KEY_7:   // 19200 bps
+      set_bps(CALC_BPS(19200), CALC_BPS_ERROR(19200), '7');
       break;
-    case PS2_KEY_8:   // 38400 bps
-      uart_bps = CALC_BPS(38400);
-      send_raw('8');
+    case HID_KEY_8:   // 38400 bps
+      set_bps(CALC_BPS(38400), CALC_BPS_ERROR(38400), '8');
       break;
-    case PS2_KEY_9:   // 57600 bps
-      uart_bps = CALC_BPS(57600);
-      send_raw('9');
+    case HID_KEY_9:   // 57600 bps
+      set_bps(CALC_BPS(57600), CALC_BPS_ERROR(57600), '9');
       break;
-    case PS2_KEY_O:   // Odd Parity
+    case HID_KEY_O:   // Odd Parity
       uart_parity = PARITY_ODD;
       send_raw('o');
       break;
-    case PS2_KEY_E:   // Even Parity
+    case HID_KEY_E:   // Even Parity
       uart_parity = PARITY_EVEN;
       send_raw('e');
       break;
-    case PS2_KEY_N:   // No Parity
+    case HID_KEY_N:   // No Parity
       uart_parity = PARITY_NONE;
       send_raw('n');
       break;
-    case PS2_KEY_BS:   // Use Backspace
+    case HID_KEY_BS:   // Use Backspace
       globalopts |= OPT_BACKSPACE;
       send_raw('b');
       send_raw('s');
       break;
-    case PS2_KEY_DELETE | 0x80:   // Use Delete
+    case HID_KEY_DELETE:   // Use Delete
       globalopts &= (uint8_t)~OPT_BACKSPACE;
       send_raw('d');
       send_raw('l');
       break;
-    case PS2_KEY_Q:
+#ifdef BRIDGE_SUPPORT
+    case HID_KEY_B:   // UART to parallel bridge off
+      globalopts &= (uint8_t)~OPT_BRIDGE;
+      send_raw('b');
+      break;
+#endif
+#ifdef PAR_BUSY_SUPPORT
+    case HID_KEY_A:   // pace parallel port by holdoff only
+      globalopts &= (uint8_t)~OPT_HANDSHAKE;
+      send_raw('a');
+      break;
+#endif
+#ifdef UART_AUTOBAUD_SUPPORT
+    case HID_KEY_Z:   // fixed bit rate
+      uart_autobaud = FALSE;
+      send_raw('z');
+      break;
+#endif
+    case HID_KEY_F:   // no flow control
+      uart_flow = FLOW_NONE;
+      send_raw('f');
+      break;
+    case HID_KEY_U:   // UART output off
+      globalopts |= OPT_NO_UART;
+      send_raw('u');
+      break;
+    case HID_KEY_C:   // parallel output off
+      globalopts |= OPT_NO_PAR;
+      send_raw('c');
+      break;
+    case HID_KEY_Q:
       send_raw('<');
       sendhex(OSCCAL);
       send_raw(':');
@@ -1003,9 +631,17 @@ static void set_options(uint8_t key) {
       sendhex(pulselen);
       send_raw(':');
       sendhex(resetlen);
+      send_raw(':');
+      sendhex(uart_flow);
+      send_raw(':');
+      sendhex(ps2_half);
+      send_raw(':');
+      sendhex(ps2_gap);
+      if(uart_tx_paused())
+        send_raw('p');
       send_raw('>');
       break;
-    case PS2_KEY_W:   // Save Data
+    case HID_KEY_W:   // Save Data
       eeprom_write_config();
       send_raw('w');
       break;
@@ -1013,20 +649,156 @@ static void set_options(uint8_t key) {
   }
 }
 
-static void parse_key(uint8_t key, uint8_t keydown) {
+static inline __attribute__((always_inline)) uint8_t key_is_down(uint8_t key) {
+  return keys_down[key >> 3] & _BV(key & 7);
+}
+
+static void key_mark(uint8_t key, uint8_t keydown) {
+  if(keydown)
+    keys_down[key >> 3] |= _BV(key & 7);
+  else
+    keys_down[key >> 3] &= (uint8_t)~_BV(key & 7);
+}
+
+// rebuild the modifier META flags, either side of a pair counts.
+static void update_meta(void) {
+  meta &= POLL_FLAG_LOCKS;
+  if(key_is_down(HID_KEY_LSHIFT))
+    meta |= POLL_FLAG_LSHIFT;
+  if(key_is_down(HID_KEY_RSHIFT))
+    meta |= POLL_FLAG_RSHIFT;
+  if(key_is_down(HID_KEY_ALT) || key_is_down(HID_KEY_RALT))
+    meta |= POLL_FLAG_ALT;
+  if(key_is_down(HID_KEY_LCTRL) || key_is_down(HID_KEY_RCTRL))
+    meta |= POLL_FLAG_CONTROL;
+}
+
+/*
+ * The keyboard or the mode changed under us, so anything still down
+ * would stay held on the output.  Send a break for every key we think
+ * is down through the output's encoder, then drop any extended shift
+ * left behind.
+ */
+static void release_keys(void (*out)(uint8_t, uint8_t)) {
+  uint8_t i;
+  uint8_t j;
+  uint8_t bits;
+
+  meta &= POLL_FLAG_LOCKS;
+  for(i = 0; i < sizeof(keys_down); i++) {
+    bits = keys_down[i];
+    keys_down[i] = 0;
+    for(j = 0; bits; j++, bits >>= 1) {
+      if(bits & 1)
+        out((i << 3) | j, FALSE);
+    }
+  }
+  if(xt_eshift) {
+    xt_putc(XT_KEY_EXT);
+    xt_putc(XT_KEY_LSHIFT | 0x80);
+    xt_eshift = FALSE;
+  }
+}
+
+/*
+ * Keyboard commands go out one byte at a time, each waiting for its ACK.
+ * Requests only set a pending bit, so a burst of lock key presses becomes
+ * a single LED update carrying the latest state.  Each keyboard keeps its
+ * own command in flight, so they all end up with the same LEDs and rate.
+ */
+static void kb_send(uint8_t p, uint8_t data) {
+  ps2_port_putc(p, data);
+  kb[p].sent = timer_now();
+}
 
-  if((key & 0x7f)==PS2_KEY_ALT) {
-    // turn on or off the ALT META flag
-    meta = (meta & (uint8_t)~POLL_FLAG_ALT) | (keydown ? POLL_FLAG_ALT : 0);
-  } else if((key & 0x7f)==PS2_KEY_LCTRL) {
-    // turn on or off the CTRL META flag
-    meta = (meta & (uint8_t)~POLL_FLAG_CONTROL) | (keydown ? POLL_FLAG_CONTROL : 0);
-  } else if(key == PS2_KEY_LSHIFT) {
-    meta = (meta & (uint8_t)~POLL_FLAG_LSHIFT) | (keydown ? POLL_FLAG_LSHIFT : 0);
-  } else if(key == PS2_KEY_RSHIFT) {
-    meta = (meta & (uint8_t)~POLL_FLAG_RSHIFT) | (keydown ? POLL_FLAG_RSHIFT : 0);
+static void kb_start(uint8_t p) {
+  if(kb[p].pending & KB_PEND_LEDS) {
+    kb[p].pending &= (uint8_t)~KB_PEND_LEDS;
+    kb[p].cmd = PS2_CMD_LEDS;
+    kb[p].arg = led_state;
+  } else {
+    kb[p].pending &= (uint8_t)~KB_PEND_RATE;
+    kb[p].cmd = PS2_CMD_SET_RATE;
+    kb[p].arg = CALC_RATE(type_delay, type_rate);
   }
-  if((meta & POLL_FLAG_CTRL_ALT) == POLL_FLAG_CTRL_ALT && key == (0x80 | PS2_KEY_DELETE) && keydown) {
+  kb[p].tries = 0;
+  kb[p].state = KB_ST_CMD;
+  kb_send(p, kb[p].cmd);
+}
+
+// no ACK or a RESEND, start the command over, or give up on it.
+static void kb_retry(uint8_t p) {
+  if(++kb[p].tries > KB_CMD_RETRIES) {
+    kb[p].state = KB_ST_IDLE;
+  } else {
+    kb[p].state = KB_ST_CMD;
+    kb_send(p, kb[p].cmd);
+  }
+}
+
+// returns TRUE if key was the reply to our command.
+static uint8_t kb_reply(uint8_t p, uint8_t key) {
+  if(kb[p].state == KB_ST_IDLE || (key != PS2_CMD_ACK && key != PS2_CMD_RESEND))
+    return FALSE;
+  if(key == PS2_CMD_RESEND) {
+    kb_retry(p);
+  } else if(kb[p].state == KB_ST_CMD) {
+    kb[p].state = KB_ST_ARG;
+    kb_send(p, kb[p].arg);
+  } else {
+    kb[p].state = KB_ST_IDLE;
+  }
+  return TRUE;
+}
+
+static void kb_task(void) {
+  uint8_t p;
+
+  for(p = 0; p < KB_PORTS; p++) {
+    if(kb[p].state != KB_ST_IDLE && (uint16_t)(timer_now() - kb[p].sent) >= KB_CMD_TIMEOUT)
+      kb_retry(p);
+    if(kb[p].state == KB_ST_IDLE && kb[p].pending)
+      kb_start(p);
+  }
+}
+
+// TRUE if a keyboard is free to take a pending command.
+static uint8_t kb_ready(void) {
+  uint8_t p;
+
+  for(p = 0; p < KB_PORTS; p++) {
+    if(kb[p].state == KB_ST_IDLE && kb[p].pending)
+      return TRUE;
+  }
+  return FALSE;
+}
+
+static void kb_request(uint8_t what) {
+  uint8_t p;
+
+  for(p = 0; p < KB_PORTS; p++)
+    kb[p].pending |= what;
+}
+
+static void set_leds(void) {
+  kb_request(KB_PEND_LEDS);
+}
+
+/*
+ * A keyboard that passed BAT is back at its defaults: LEDs off and the
+ * default typematic rate, and it has forgotten any command in flight.
+ */
+static void restore_kb(uint8_t p) {
+  kb[p].state = KB_ST_IDLE;
+  kb[p].pending = KB_PEND_LEDS | KB_PEND_RATE;
+}
+
+static void parse_key(uint8_t key, uint8_t keydown) {
+
+  key_mark(key, keydown);
+  if(key >= HID_KEY_LCTRL)
+    update_meta();
+  if((meta & POLL_FLAG_CTRL_ALT) == POLL_FLAG_CTRL_ALT && key == HID_KEY_DELETE && keydown) {
     // CTRL/ALT/DEL is pressed.
     // bring RESET line low
     if(globalopts & OPT_RESET_HI) {
@@ -1038,21 +810,22 @@ static void parse_key(uint8_t key, uint8_t keydown) {
       delay_reset(resetlen);
       reset_set_hi();
     }
-  } else if(mode_config() && (meta&POLL_FLAG_CTRL_ALT) == POLL_FLAG_CTRL_ALT && key == PS2_KEY_BS && keydown) {
+  } else if(mode_config() && (meta&POLL_FLAG_CTRL_ALT) == POLL_FLAG_CTRL_ALT && key == HID_KEY_BS && keydown) {
     // CTRL/ALT/BS config mode
     config ^= KB_CONFIG;
-    if(!config) {
-      uart_config(uart_bps, uart_length, uart_parity, uart_stop);
-      ps2_putc(PS2_CMD_SET_RATE);
-      ps2_putc(CALC_RATE(type_delay, type_rate));
-    }
+    release_keys(hid_to_xt);
+    uart_setup();
+    if(!config)
+      kb_request(KB_PEND_RATE);
+    // the toggle is ours, the XT side only sees its break.
+    return;
   } else if (config) {
     if(keydown) { // set parms on keydown
       set_options(key);
     }
   } else if (keydown) {
     switch (key) {
-      case PS2_KEY_CAPS_LOCK:
+      case HID_KEY_CAPS_LOCK:
         if(meta & POLL_FLAG_CAPS_LOCK) {
           meta &= (uint8_t)~POLL_FLAG_CAPS_LOCK;
           led_state &= (uint8_t)~PS2_LED_CAPS_LOCK;
@@ -1060,10 +833,9 @@ static void parse_key(uint8_t key, uint8_t keydown) {
           meta |= POLL_FLAG_CAPS_LOCK;
           led_state |= PS2_LED_CAPS_LOCK;
         }
-        ps2_putc(PS2_CMD_LEDS);
-        ps2_putc(led_state);
+        set_leds();
         break;
-      case PS2_KEY_NUM_LOCK:
+      case HID_KEY_NUM_LOCK:
         if(meta & POLL_FLAG_NUM_LOCK) {
           meta &= (uint8_t)~POLL_FLAG_NUM_LOCK;
           led_state &= (uint8_t)~PS2_LED_NUM_LOCK;
@@ -1071,10 +843,9 @@ static void parse_key(uint8_t key, uint8_t keydown) {
           meta |= POLL_FLAG_NUM_LOCK;
           led_state |= PS2_LED_NUM_LOCK;
         }
-        ps2_putc(PS2_CMD_LEDS);
-        ps2_putc(led_state);
+        set_leds();
         break;
-      case PS2_KEY_SCROLL_LOCK:
+      case HID_KEY_SCROLL_LOCK:
         if(meta & POLL_FLAG_SCROLL_LOCK) {
           meta &= (uint8_t)~POLL_FLAG_SCROLL_LOCK;
           led_state &= (uint8_t)~PS2_LED_SCROLL_LOCK;
@@ -1082,196 +853,437 @@ static void parse_key(uint8_t key, uint8_t keydown) {
           meta |= POLL_FLAG_SCROLL_LOCK;
           led_state |= PS2_LED_SCROLL_LOCK;
         }
-        ps2_putc(PS2_CMD_LEDS);
-        ps2_putc(led_state);
+        set_leds();
         break;
       default:
-        ps2_to_ascii(key);
+        hid_to_ascii(key);
         break;
     }
   }
-  ps2_to_xt(key,keydown);
+  hid_to_xt(key,keydown);
+}
+
+static uint8_t bridge_ready(void) {
+#ifdef BRIDGE_SUPPORT
+  return ((globalopts & OPT_BRIDGE)
+          && !(globalopts & OPT_NO_PAR)
+          && !config
+          && uart_data_available()
+          && par_free());
+#else
+  return FALSE;
+#endif
+}
+
+static uint8_t ps2_events(void) {
+  return (kb_next_port() < KB_PORTS
+          || ev_data_available()
+          || bridge_ready()
+          || kb_ready()
+          || ms_events()
+          || mat_data_available()
+          || autobaud_events());
+}
+
+static uint8_t xt_events(void) {
+  return (xt_data_available()
+          || ev_data_available()
+          || mat_data_available()
+          || autobaud_events());
+}
+
+// run one scan code through the prefix matcher, queue any key it completes.
+static void decode_key(evsrc_t src, kmseq_t *seq, uint8_t key) {
+  uint8_t hid;
+  uint8_t r = km_seq_step(seq, key, &hid);
+
+  if(r & KM_SEQ_DOWN)
+    ev_putc(src, hid, FALSE);
+  if(r & KM_SEQ_UP)
+    ev_putc(src, hid, TRUE);
+}
+
+#ifdef MATRIX_SUPPORT
+static uint8_t mat_fn;                // Fn keys held, bit n - 1 for Fn n
+static uint8_t mat_hid[MAT_KEYS];     // usage each held key went out as
+
+static uint8_t mat_layer(void) {
+  uint8_t layer = 0;
+  uint8_t fn = mat_fn;
+
+  while(fn) {
+    layer++;
+    fn >>= 1;
+  }
+  return (layer < MAT_LAYERS ? layer : MAT_LAYERS - 1);
+}
+
+/*
+ * A key goes up as whatever it went down as, so letting go of Fn first
+ * does not leave a key stuck.  A repeat is a second keydown for a key
+ * that is already held.  Modifiers and Fn keys do not repeat.
+ */
+static void matrix_key(uint8_t data) {
+  uint8_t code = data & (uint8_t)~MAT_KEY_UP;
+  uint8_t up = data & MAT_KEY_UP;
+  uint8_t hid;
+
+  if(code >= MAT_KEYS)
+    return;
+  hid = mat_hid[code];
+  if(up) {
+    mat_hid[code] = HID_KEY_NONE;
+    mat_clear_repeat_code(code);
+  } else if(hid == HID_KEY_NONE) {
+    hid = km_matrix_to_hid(code, mat_layer());
+    mat_hid[code] = hid;
+    if(hid != HID_KEY_NONE && hid < HID_KEY_LCTRL)
+      mat_set_repeat_code(code);
+  }
+  if(hid == HID_KEY_NONE)
+    return;
+  if(KM_IS_FN(hid)) {
+    if(up)
+      mat_fn &= (uint8_t)~(1 << (KM_FN_LAYER(hid) - 1));
+    else
+      mat_fn |= (1 << (KM_FN_LAYER(hid) - 1));
+    return;
+  }
+  ev_putc(EV_SRC_MATRIX, hid, up);
+}
+
+static void poll_matrix(void) {
+  while(mat_data_available())
+    matrix_key(mat_recv());
+}
+
+// the matrix repeats keys itself, at the configured typematic rate.
+static void matrix_init(void) {
+  uint8_t rate = CALC_RATE(type_delay, type_rate);
+
+  mat_init();
+  mat_set_repeat_delay(ps2_get_typematic_delay(rate));
+  mat_set_repeat_period(ps2_get_typematic_period(rate));
 }
+#else
+#  define poll_matrix()       do {} while(0)
+#  define matrix_init()       do {} while(0)
+#endif
 
+// host mode: key events become ASCII and XT scan codes.
+static void host_events(void) {
+  event_t ev;
+
+  while(ev_data_available()) {
+    ev_getc(&ev);
+    parse_key(ev.code, EV_KEYDOWN(ev));
+  }
+}
+
+// device mode: key events go out to the PC as PS/2 scan codes.
+static void device_events(void) {
+  event_t ev;
+
+  while(ev_data_available()) {
+    ev_getc(&ev);
+    key_mark(ev.code, EV_KEYDOWN(ev));
+    hid_to_ps2(ev.code, EV_KEYDOWN(ev));
+  }
+}
+
+/*
+ * Sleep until an IRQ fires, unless one already left work behind.  IRQs
+ * stay off from the final check until the sleep instruction, so no
+ * wakeup can be lost in between.
+ */
+static inline __attribute__((always_inline)) void wait_for_event(uint8_t (*pending)(void)) {
+  cli();
+  if(!pending()) {
+    sleep_enable();
+    sei();                    // takes effect after the next instruction
+    sleep_cpu();
+    sleep_disable();
+  }
+  sei();
+}
+
+/*
+ * With two keyboards, each has its own prefix state and command state,
+ * but their keys land in one event queue and one set of modifiers and
+ * locks, so shift on one keyboard applies to keys on the other.  They
+ * share keys_down too, so a BAT on either one releases the keys held on
+ * both, and a key held on both goes up with the first release.
+ */
 static inline __attribute__((always_inline)) void poll_ps2_kb(void) {
   uint8_t key;
-  poll_state_t state = POLL_ST_IDLE;
+  uint8_t p;
+  kmseq_t seq[KB_PORTS];
 
+  for(p = 0; p < KB_PORTS; p++)
+    km_seq_init(&seq[p], KM_SEQ_SET2);
   for(;;) {
-    if(ps2_data_available() != 0) {
+    wait_for_event(ps2_events);
+    check_autobaud();
+    if(bridge_ready()) {
+      // host sent data, pass it straight through to the parallel port.
+      par_putc(uart_getc());
+    }
+    p = kb_next_port();
+    if(p < KB_PORTS) {
       // kb sent data...
-      key = ps2_getc();
+      key = ps2_port_getc(p);
       if(key == PS2_CMD_BAT) {
-        state = POLL_ST_IDLE;
-      } else {
-        switch(state) {
-          case POLL_ST_IDLE:
-            switch(key) {
-              case PS2_KEY_EXT:
-                // we got E0
-                state=POLL_ST_GET_X_KEY;
-                break;
-              case PS2_KEY_UP:
-                // get normal key up.
-                state=POLL_ST_GET_KEY_UP;
-                break;
-              case PS2_KEY_EXT_2:
-                // we got an E1
-                state=POLL_ST_GET_PAUSE_1;
-                // start on the Pause/Break sequence.
-                break;
-              case PS2_CMD_ACK:
-              case PS2_CMD_ECHO:
-              case PS2_CMD_ERROR:
-              case PS2_CMD_OVERFLOW:
-                break;
-              default:
-                parse_key(key,TRUE);
-                state=POLL_ST_IDLE;
-                break;
-            }
-            break;
-          case POLL_ST_GET_KEY_UP:
-            parse_key(key,FALSE);
-            state=POLL_ST_IDLE;
-            break;
-          case POLL_ST_GET_X_KEY:
-            if(key==PS2_KEY_UP) {
-              state=POLL_ST_GET_X_KEY_UP;
-            } else if(key==PS2_KEY_LSHIFT) {
-              // when NumLock is pressed, INS and DEL prepend with EO 12 (extended shift), but we don't care, so eat code.
-              // Also, when PrintScreen is pressed, it too sends an E0 12
-              state=POLL_ST_IDLE;
-            } else {
-              parse_key(0x80 | key,TRUE);
-              state=POLL_ST_IDLE;
-            }
-            break;
-          case POLL_ST_GET_X_KEY_UP:
-            if(key==PS2_KEY_LSHIFT) {
-              // when NumLock is pressed, INS and DEL prepend with EO 12 (extended shift), but we don't care, so eat code.
-              // Also, when PrintScreen is pressed, it too sends an E0 12
-              state=POLL_ST_IDLE;
-            } else {
-              parse_key(0x80 | key,FALSE);
-              state=POLL_ST_IDLE;
-            }
-            break;
-          case POLL_ST_GET_PAUSE_1:
-            // we get 14
-            if(key==PS2_KEY_PCTRL) {
-              state=POLL_ST_GET_PAUSE_2;
-            } else {
-              state=POLL_ST_IDLE;
-            }
-            break;
-          case POLL_ST_GET_PAUSE_2:
-            // we got 77
-            if(key==PS2_KEY_PAUSE) {
-              state=POLL_ST_GET_PAUSE_3;
-            } else {
-              state=POLL_ST_IDLE;
-            }
-            break;
-          case POLL_ST_GET_PAUSE_3:
-            // we get E1
-            if(key==PS2_KEY_EXT_2) {
-              state=POLL_ST_GET_PAUSE_4;
-            } else {
-              state=POLL_ST_IDLE;
-            }
-            break;
-          case POLL_ST_GET_PAUSE_4:
-            // we got F0
-            if(key==PS2_KEY_UP) {
-              state=POLL_ST_GET_PAUSE_5;
-            } else {
-              state=POLL_ST_IDLE;
-            }
-            break;
-          case POLL_ST_GET_PAUSE_5:
-            // we got 14
-            if(key==PS2_KEY_PCTRL) {
-              state=POLL_ST_GET_PAUSE_6;
-            } else {
-              state=POLL_ST_IDLE;
-            }
-            break;
-          case POLL_ST_GET_PAUSE_6:
-            // we got F0
-            if(key==PS2_KEY_UP) {
-              state=POLL_ST_GET_PAUSE_7;
-            } else {
-              state=POLL_ST_IDLE;
-            }
-            break;
-          case POLL_ST_GET_PAUSE_7:
-            // we got 77
-            if(key==PS2_KEY_PAUSE) {
-              //('R');
-              // we received a complete Pause/Break, do something about it.
-              parse_key(0x80|PS2_KEY_PAUSE,TRUE);
-              parse_key(0x80|PS2_KEY_PAUSE,FALSE);
-            }
-            state=POLL_ST_IDLE;
-            break;
-        }
+        // keyboard was reset or swapped, finish the old one's keys first.
+        km_seq_reset(&seq[p]);
+        host_events();
+        release_keys(hid_to_xt);
+        restore_kb(p);
+      } else if(!kb_reply(p, key)) {
+        decode_key((p ? EV_SRC_PS2_1 : EV_SRC_PS2), &seq[p], key);
       }
     }
+    poll_matrix();
+    host_events();
+    kb_task();
+    ms_task(!config);
   }
 }
 
+/*
+ * 0xAA is both XT BAT and the left shift break.  Outside a sequence and
+ * with left shift up, it can only be BAT: the keyboard was reset or
+ * swapped, so release what the PC thinks is still held.
+ */
 static inline __attribute__((always_inline)) void poll_xt_kb(void) {
   uint8_t key;
-  //poll_state_t state = POLL_ST_IDLE;
+  kmseq_t seq;
 
+  km_seq_init(&seq, KM_SEQ_SET1);
   for(;;) {
+    wait_for_event(xt_events);
+    check_autobaud();
     if(xt_data_available() != 0) {
       // kb sent data...
       key = xt_getc();
-      xt_to_ps2(key);
+      if(key == XT_CMD_BAT && seq.state == seq.start && !key_is_down(HID_KEY_LSHIFT)) {
+        device_events();
+        release_keys(hid_to_ps2);
+      } else {
+        decode_key(EV_SRC_XT, &seq, key);
+      }
     }
+    poll_matrix();
+    device_events();
   }
 }
 
-//ISR(TIMER_vect) {
-  //mat_scan();
-  //sw_scan();
-//}
+#ifdef PS2_PASSTHRU
+// the Pause sequence is the longest a key can take.
+#define PT_PEND_MAX           8
+
+static uint8_t passthru_events(void) {
+  return (ps2_data_available() || ps2_port_data_available(PS2_KB_PORT));
+}
+
+// the keyboard's answers to commands, never part of a key.
+static uint8_t pt_is_reply(uint8_t key) {
+  switch(key) {
+    case PS2_CMD_ACK:
+    case PS2_CMD_RESEND:
+    case PS2_CMD_BAT:
+    case PS2_CMD_ECHO_RESP:
+    case PS2_CMD_BAT_FAILURE:
+    case PS2_CMD_ERROR:
+    case PS2_CMD_OVERFLOW:
+      return TRUE;
+  }
+  return FALSE;
+}
+
+/*
+ * A PS/2 keyboard in front of the PC.  Codes the remap table leaves alone
+ * go out exactly as received, held back only until the key is known, so
+ * a prefixed key is late by one byte at most.  PC commands go to the
+ * keyboard unchanged, so the keyboard itself answers LED, rate and ID
+ * requests, and its replies come straight back.  The remap table is in
+ * set 2 terms, so once the PC picks another code set, keys pass through
+ * untouched until a reset.  Both ports share the free running PS/2 timer,
+ * so the clock to the PC comes from the per tick compare advance in ps2.c.
+ */
+static inline __attribute__((always_inline)) void poll_ps2_passthru(void) {
+  kmseq_t seq;
+  uint8_t pend[PT_PEND_MAX];
+  uint8_t len = 0;
+  uint8_t data = 0;   // data bytes still due after an ACK
+  uint8_t last = 0;   // previous byte from the PC
+  uint8_t cset = 2;   // code set the PC asked for
+  uint8_t key;
+  uint8_t hid;
+  uint8_t r;
+  uint8_t i;
+
+  km_seq_init(&seq, KM_SEQ_SET2);
+  for(;;) {
+    wait_for_event(passthru_events);
+    if(ps2_data_available()) {
+      key = ps2_getc();
+      // the ID and the code set query answer with data after the ACK.
+      if(key == PS2_CMD_READ_ID)
+        data = 2;
+      else if(last == PS2_CMD_SET_CODE_SET && !key)
+        data = 1;
+      else if(last == PS2_CMD_SET_CODE_SET)
+        cset = key;
+      else if(key == PS2_CMD_RESET)
+        cset = 2;
+      last = key;
+      ps2_port_putc(PS2_KB_PORT, key);
+    }
+    if(ps2_port_data_available(PS2_KB_PORT)) {
+      key = ps2_port_getc(PS2_KB_PORT);
+      // BAT means set 2 again, except in set 1 where AA is left shift up.
+      if(key == PS2_CMD_BAT && cset != 1)
+        cset = 2;
+      if(data || pt_is_reply(key) || cset != 2) {
+        if(data && !pt_is_reply(key))
+          data--;
+        km_seq_reset(&seq);
+        pend[len++] = key;
+      } else {
+        pend[len++] = key;
+        r = km_seq_step(&seq, key, &hid);
+        if(seq.state != seq.start && len < PT_PEND_MAX)
+          continue;   // key not known yet
+        km_seq_reset(&seq);
+        if(r != KM_SEQ_NONE && km_remap(hid) != hid) {
+          hid = km_remap(hid);
+          if(r & KM_SEQ_DOWN)
+            hid_to_ps2(hid, TRUE);
+          if(r & KM_SEQ_UP)
+            hid_to_ps2(hid, FALSE);
+          len = 0;
+        }
+      }
+      for(i = 0; i < len; i++)
+        ps2_putc(pend[i]);
+      len = 0;
+    }
+  }
+}
+#endif
 
 /*static inline __attribute__((always_inline)) void scan_inputs(void) {
   uint8_t data;
 
   for(;;) {
-    if(mat_data_available()) {
-      data=mat_recv();
-      uart_puthex(data);
-    }
     if(sw_data_available()) {
 
       // handle special switches.
       data=sw_getc();
       uart_puthex(data);
-      if(data & SW_UP) {
-      } else {
-        // only act on key depress
-        switch(data & (SW_UP - 1)) {
-          case SW_A:
-            ps2_putc(PS2_KEY_F1);
-            ps2_putc(PS2_KEY_UP);
-            ps2_putc(PS2_KEY_F1);
-            break;
-          case SW_B:
-            ps2_putc(PS2_KEY_F2);
-            ps2_putc(PS2_KEY_UP);
-            ps2_putc(PS2_KEY_F2);
-            break;
-        }
+      switch(data & (SW_UP - 1)) {
+        case SW_A:
+          ev_putc(EV_SRC_SWITCH, HID_KEY_F1, data & SW_UP);
+          break;
+        case SW_B:
+          ev_putc(EV_SRC_SWITCH, HID_KEY_F2, data & SW_UP);
+          break;
       }
     }
+    device_events();
   }
 }*/
 
+#ifdef KB_AUTODETECT
+// a PS/2 keyboard ignores commands until its power-up BAT is out.
+#define KB_PROBE_BAT          TIMER_MS(750)
+// an AT/PS2 keyboard ACKs READ_ID within a few ms, the ID follows it.
+#define KB_PROBE_PS2          TIMER_MS(50)
+#define KB_PROBE_PS2_ID       TIMER_MS(20)
+// XT self test takes a few hundred ms after the reset pulse.
+#define KB_PROBE_XT           TIMER_MS(750)
+#define KB_XT_RESET_MS        20
+// an XT frame is 9 CLKs, 10 with the 5150's two start bits, PS/2 is 11.
+#define KB_XT_FRAME_MAX       10
+
+static uint8_t probe_wait_ps2(uint16_t wait, uint8_t want) {
+  uint16_t start = timer_now();
+
+  while((uint16_t)(timer_now() - start) < wait) {
+    if(ps2_data_available() && ps2_getc() == want)
+      return TRUE;
+  }
+  return FALSE;
+}
+
+/*
+ * The PS/2 receiver only hands over full 11 CLK frames, so a BAT seen
+ * here is a PS/2 keyboard.  If it was already up, ask for its ID.
+ */
+static uint8_t probe_ps2(void) {
+  ps2_init(PS2_MODE_HOST);
+  if(probe_wait_ps2(KB_PROBE_BAT, PS2_CMD_BAT))
+    return TRUE;
+  ps2_putc(PS2_CMD_READ_ID);
+  if(probe_wait_ps2(KB_PROBE_PS2, PS2_CMD_ACK)) {
+    // soak up the ID, so it does not turn up as keys later.
+    probe_wait_ps2(KB_PROBE_PS2_ID, 0xff);
+    return TRUE;
+  }
+  // a send nobody clocked out leaves DATA low, let go of the port.
+  ps2_init(PS2_MODE_HOST);
+  return FALSE;
+}
+
+static uint8_t probe_xt(void) {
+  uint16_t start;
+  uint8_t key;
+
+  // holding clock low resets an XT keyboard, it answers with 0xAA.
+  xt_clear_clk();
+  _delay_ms(KB_XT_RESET_MS);
+  xt_set_clk();
+  xt_init(XT_MODE_HOST);
+  xt_host_clocks();
+  start = timer_now();
+  while((uint16_t)(timer_now() - start) < KB_PROBE_XT) {
+    if(xt_data_available()) {
+      key = xt_getc();
+      // a PS/2 frame still has its parity and stop CLKs to come.
+      _delay_ms(1);
+      if(xt_host_clocks() <= KB_XT_FRAME_MAX && key == XT_CMD_BAT)
+        return TRUE;
+    }
+  }
+  xt_init(XT_MODE_HOST);
+  return FALSE;
+}
+
+/*
+ * Work out which kind of keyboard is attached.  The type found last time
+ * is tried first, so a known setup boots quickly.  If nothing answers,
+ * assume the last type, the keyboard may be plugged in later.
+ */
+static uint8_t detect_xt_kb(void) {
+  uint8_t found;
+
+  timer_init();
+  sei();
+  if(kb_type == KB_TYPE_XT)
+    found = (probe_xt() ? KB_TYPE_XT : probe_ps2() ? KB_TYPE_PS2 : KB_TYPE_UNKNOWN);
+  else
+    found = (probe_ps2() ? KB_TYPE_PS2 : probe_xt() ? KB_TYPE_XT : KB_TYPE_UNKNOWN);
+  cli();
+  if(found != KB_TYPE_UNKNOWN && found != kb_type) {
+    kb_type = found;
+    eeprom_write_config();
+  }
+  return (kb_type == KB_TYPE_XT);
+}
+#else
+#  define detect_xt_kb()      FALSE
+#endif
+
 void main(void) {
   mode_init();
   uart_init();
@@ -1279,24 +1291,39 @@ void main(void) {
   eeprom_read_config();
 
   uart_config(uart_bps, uart_length, uart_parity, uart_stop);
+  uart_set_flow(uart_flow);
+
+  // timers, UART and pin change IRQs all keep running in idle.  The
+  // matrix scan wakes us every .5 mS, and the timebase every 65 mS.
+  set_sleep_mode(SLEEP_MODE_IDLE);
 
-  if(mode_device()) {
+  if(mode_device() || detect_xt_kb()) {
     ps2_init(PS2_MODE_DEVICE);
+    ps2_set_timing(ps2_half, ps2_gap, ps2_adapt);
+#ifdef PS2_PASSTHRU
+    ps2_port_init(PS2_KB_PORT, PS2_MODE_HOST);
+#else
     xt_init(XT_MODE_HOST);
+#endif
 
-    //mat_init();
+    matrix_init();
     //sw_init(_BV(SW_A) | _BV(SW_B));
 
-    //timer_init();
+    timer_init();
 
     sei();
     uart_putc('d');
 
+#ifdef PS2_PASSTHRU
+    poll_ps2_passthru();
+#else
     poll_xt_kb();
+#endif
 
     //scan_inputs();
   } else {
     data_init();
+    busy_init();
     reset_init();
     reset_set_hi();
 
@@ -1308,13 +1335,25 @@ void main(void) {
       reset_set_lo();
     else
       reset_set_hi();
+    timer_init();
+    par_init();
+    matrix_init();
     ps2_init(PS2_MODE_HOST);
+#ifdef PS2_KB_MERGE
+    ps2_port_init(1, PS2_MODE_HOST);
+#endif
     xt_init(XT_MODE_DEVICE);
+    xt_set_timing(xt_timing, xt_adapt);
+    ms_init();
+    uart_setup();
 
     sei();
 
     uart_putc('h');
     ps2_putc(PS2_CMD_RESET);
+#ifdef PS2_KB_MERGE
+    ps2_port_putc(1, PS2_CMD_RESET);
+#endif
 
     poll_ps2_kb();
   }
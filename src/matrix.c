@@ -22,6 +22,8 @@
 
 #include <inttypes.h>
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
 #include "config.h"
 #include "uart.h"
 #include "matrix.h"
@@ -31,6 +33,8 @@ static volatile uint8_t           rx_head;
 static volatile uint8_t           rx_tail;
 
 static MAT_COL_DTYPE              mat_save[1 << MAT_SCAN_SHIFT];
+// vertical counters, bit n of mat_db[b][row] is bit b of column n's count
+static MAT_COL_DTYPE              mat_db[MAT_DB_SHIFT][1 << MAT_SCAN_SHIFT];
 static volatile mat_state_t       mat_state;
 static volatile uint8_t           mat_scan_idx;
 
@@ -89,32 +93,77 @@ static inline void mat_decode(MAT_COL_DTYPE new, uint8_t t) {
   mat_save[t] = new;
 }
 
-inline void mat_scan(void) {
-  // this should be called 120 times/sec for each scanned row.
+#ifdef MAT_DB_DEFER
+/*
+ * A key changes once it has read the other way 1 << MAT_DB_SHIFT scans
+ * in a row.  Keys that read the same as before start over at 0, the
+ * carry out of the top bit is the set of keys that made it.
+ */
+static inline MAT_COL_DTYPE mat_debounce(MAT_COL_DTYPE in, uint8_t t) {
+  MAT_COL_DTYPE delta = in ^ mat_save[t];
+  MAT_COL_DTYPE carry = delta;
+  MAT_COL_DTYPE c;
+  uint8_t b;
+
+  for(b = 0; b < MAT_DB_SHIFT; b++) {
+    c = mat_db[b][t];
+    mat_db[b][t] = (c ^ carry) & delta;
+    carry &= c;
+  }
+  return mat_save[t] ^ carry;
+}
+#else
+/*
+ * The first edge goes straight out, then the key is ignored until its
+ * count wraps, (1 << MAT_DB_SHIFT) - 1 scans later.  Whatever it reads
+ * then is taken as is, so a short tap still gets its key up.
+ */
+static inline MAT_COL_DTYPE mat_debounce(MAT_COL_DTYPE in, uint8_t t) {
+  MAT_COL_DTYPE busy = 0;
+  MAT_COL_DTYPE carry;
+  MAT_COL_DTYPE edge;
+  MAT_COL_DTYPE c;
+  uint8_t b;
+
+  for(b = 0; b < MAT_DB_SHIFT; b++)
+    busy |= mat_db[b][t];
+  carry = busy;
+  for(b = 0; b < MAT_DB_SHIFT; b++) {
+    c = mat_db[b][t];
+    mat_db[b][t] = c ^ carry;
+    carry &= c;
+  }
+  edge = (in ^ mat_save[t]) & (MAT_COL_DTYPE)~busy;
+  mat_db[0][t] |= edge;
+  return mat_save[t] ^ edge;
+}
+#endif
+
+static inline void mat_scan(void) {
+  // this is called every .5 ms, a row takes two calls.
   uint8_t t;
   MAT_COL_DTYPE in;
 
+  if(mat_repeat) {
+    mat_repeat_count--;
+    if(!mat_repeat_count) {
+      mat_repeat_count = mat_repeat_period;
+      mat_store(mat_repeat_code);
+    }
+  }
   // this is where we scan.
-  // we scan at 120Hz
   switch(mat_state) {
     default:
     case MAT_ST_PREP:
-      if(mat_repeat) {
-        mat_repeat_count--;
-        if(!mat_repeat_count) {
-          mat_repeat_count = mat_repeat_period;
-          mat_store(mat_repeat_code);
-        }
-      }
       // do housekeeping
-      in = mat_curr_value;
       t = mat_scan_idx;
+      in = mat_debounce(mat_curr_value, t);
       if(in != mat_save[t]) {
         //mat_decode(in, &mat_save[t], t * MAT_COL_LEN );
         mat_decode(in, t);
       }
       for(;;) {  // skip unused pins
-        t = (t + 1) % ((1 << MAT_SCAN_SHIFT) - 1);
+        t = (t + 1) & ((1 << MAT_SCAN_SHIFT) - 1);
         if((uint16_t)(1  << t) & (uint16_t)MAT_ROW_MASK) {
           break;
         }
@@ -133,34 +182,53 @@ inline void mat_scan(void) {
   }
 }
 
+ISR(MAT_TIMER_COMP_vect) {
+  MAT_OCR += MAT_TICK;
+  mat_scan();
+}
+
 void mat_init(void) {
   mat_state = MAT_ST_PREP;
   mat_repeat = FALSE;  // set keyboard repeat to 0.
   mat_set_repeat_delay(250);        // wait 250 ms
   mat_set_repeat_period(32);        // once every 32 ms
+  MAT_SET_ROW(0);                   // all rows pulled up.
   MAT_SET_COL_MASK();               // turn on column pullups.
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    MAT_OCR = MAT_TCNT + MAT_TICK;
+  }
+  MAT_TIFR = MAT_TIFR_DATA;
+  MAT_TIMSK |= MAT_TIMSK_DATA;
 }
 
 void mat_set_repeat_delay(uint16_t ms) {
-  // 1800 ticks/sec, .5 ms per tick.
-  mat_repeat_delay = (ms << 1);
-  mat_repeat_count = mat_repeat_delay;
+  // 2000 ticks/sec, .5 ms per tick.
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    mat_repeat_delay = (ms << 1);
+    mat_repeat_count = mat_repeat_delay;
+  }
 }
 
 void mat_set_repeat_period(uint16_t period) {
-  mat_repeat_period = (period << 1);
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    mat_repeat_period = (period << 1);
+  }
 }
 
 void mat_set_repeat_code(uint8_t code) {
-  if(code != mat_repeat_code) {
-    mat_repeat_count = mat_repeat_delay;
-    mat_repeat_code = code;
-    mat_repeat = TRUE;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if(code != mat_repeat_code || !mat_repeat) {
+      mat_repeat_count = mat_repeat_delay;
+      mat_repeat_code = code;
+      mat_repeat = TRUE;
+    }
   }
 }
 
-void mat_clear_repeat_code(void) {
-  mat_repeat = FALSE;
+// only the key that is repeating stops the repeat.
+void mat_clear_repeat_code(uint8_t code) {
+  if(code == mat_repeat_code)
+    mat_repeat = FALSE;
 }
 
 uint8_t mat_data_available(void) {
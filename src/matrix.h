@@ -16,12 +16,42 @@
     along with this program; if not, write to the Free Software
     Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 
-    kb.h: Definitions for generic keyboard routines
+    matrix.h: Definitions for generic switch matrix routines
 
 */
 #ifndef MATRIX_H
 #define MATRIX_H
 
+#define MAT_KEY_UP                0x80
+
+#ifdef MATRIX_SUPPORT
+
+/*
+ * Timer1 free runs (see timer.h), compare B calls the scanner every
+ * MAT_TICK counts.  Each call either drives a row or reads it back.
+ */
+#if defined __AVR_ATmega8__ || defined __AVR_ATmega16__ || defined __AVR_ATmega32__ || defined __AVR_ATmega162__
+
+#  define MAT_TIMSK             TIMSK
+#  define MAT_TIFR              TIFR
+
+#elif defined __AVR_ATmega28__ || defined __AVR_ATmega48__ || defined __AVR_ATmega88__ || defined __AVR_ATmega168__ || defined __AVR_ATmega328__
+
+#  define MAT_TIMSK             TIMSK1
+#  define MAT_TIFR              TIFR1
+
+#else
+#  error Unknown chip!
+#endif
+
+#define MAT_TIMER_COMP_vect     TIMER1_COMPB_vect
+#define MAT_OCR                 OCR1B
+#define MAT_TCNT                TCNT1
+#define MAT_TIFR_DATA           _BV(OCF1B)
+#define MAT_TIMSK_DATA          _BV(OCIE1B)
+// .5 mS per call at F_CPU/8
+#define MAT_TICK                ((uint16_t)(F_CPU / 8 / 2000))
+
 typedef enum {MAT_ST_PREP,
               MAT_ST_READ
              } mat_state_t;
@@ -30,7 +60,7 @@ typedef enum {MAT_ST_PREP,
                                         MAT_ROW_LO_DDR &= (uint8_t)~(MAT_ROW_MASK & 0xff); \
                                         MAT_ROW_LO_DDR |= (x) &0xff; \
                                         MAT_ROW_LO_OUT &= (uint8_t)~(MAT_ROW_MASK & 0xff); \
-                                        MAT_ROW_LO_OUT |= (uint8_t)~((x) & 0xff); \
+                                        MAT_ROW_LO_OUT |= (uint8_t)~(x) & (MAT_ROW_MASK & 0xff); \
                                      } while(0)
 #ifdef MAT_ROW_HI_OUT
 #  define MAT_SCAN_SHIFT          4
@@ -38,7 +68,7 @@ typedef enum {MAT_ST_PREP,
                                         MAT_ROW_HI_DDR &= (uint8_t)~(MAT_ROW_MASK >> 8); \
                                         MAT_ROW_HI_DDR |= ((x) >> 8); \
                                         MAT_ROW_HI_OUT &= (uint8_t)~(MAT_ROW_MASK >> 8); \
-                                        MAT_ROW_HI_OUT |= (uint8_t)~((x) >> 8); \
+                                        MAT_ROW_HI_OUT |= (uint8_t)~((x) >> 8) & (MAT_ROW_MASK >> 8); \
                                      } while(0)
 #  define MAT_SET_ROW(x)          do {MAT_SET_ROW_LO(x); MAT_SET_ROW_HI(x); } while(0)
 #else
@@ -57,7 +87,7 @@ typedef enum {MAT_ST_PREP,
                                         MAT_COL_HI_DDR &= ~(MAT_COL_MASK >> 8); \
                                      } while(0)
 #  define MAT_SET_COL_MASK()      do { MAT_SET_COL_MASK_LO(); MAT_SET_COL_MASK_HI(); } while (0)
-#  define MAT_GET_COL()           (MAT_COL_HI_IN << 8) | (MAT_COL_LO_IN)
+#  define MAT_GET_COL()           ((MAT_COL_HI_IN << 8) | (MAT_COL_LO_IN))
 #else
 #  define MAT_COL_DTYPE           uint8_t
 #  define MAT_GET_COL()           (MAT_COL_LO_IN)
@@ -146,16 +176,33 @@ typedef enum {MAT_ST_PREP,
 #endif
 #define MAT_COL_LEN (_B0 + _B1 + _B2 + _B3 + _B4 + _B5 + _B6 + _B7 + _B8 + _B9 + _B10 + _B11 + _B12 + _B13 + _B14 + _B15)
 
-#define MAT_KEY_UP                0x80
+// codes are row * MAT_COL_LEN + column, the keymaps in keymap.c follow that
+#if MAT_COLS != MAT_COL_LEN
+#  error "MAT_COLS does not match MAT_COL_MASK"
+#endif
+#define MAT_KEYS                  (MAT_ROWS * MAT_COLS)
+#if MAT_DB_SHIFT < 1
+#  error "MAT_DB_SHIFT must be at least 1"
+#endif
+#if MAT_KEYS > MAT_KEY_UP
+#  error "Too many matrix keys"
+#endif
 
 void mat_init(void);
 void mat_set_repeat_delay(uint16_t ms);
 void mat_set_repeat_period(uint16_t period);
 void mat_set_repeat_code(uint8_t code);
-void mat_clear_repeat_code(void);
+void mat_clear_repeat_code(uint8_t code);
 uint8_t mat_data_available( void );
 uint8_t mat_recv( void );
-void mat_scan(void);
+
+#else
+#  define mat_init()              do {} while(0)
+#  define mat_set_repeat_delay(ms) do {} while(0)
+#  define mat_set_repeat_period(period) do {} while(0)
+#  define mat_data_available()    FALSE
+#  define mat_recv()              0
+#endif
 
 #endif
 
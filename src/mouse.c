@@ -0,0 +1,287 @@
+/*
+    PS2Encoder - PS2 Keyboard to serial/parallel converter
+    Copyright Jim Brain and RETRO Innovations, 2008-2012
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+    mouse.c: PS/2 mouse host, reported as a serial mouse on the UART
+
+*/
+
+#include <inttypes.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include "config.h"
+#include "flags.h"
+#include "mouse.h"
+#include "ps2.h"
+#include "timer.h"
+#include "uart.h"
+
+typedef enum {MS_ST_BAT = 0
+             ,MS_ST_BAT_ID
+             ,MS_ST_ACK
+             ,MS_ST_ID
+             ,MS_ST_REPORT
+             ,MS_ST_RUN
+             } msstate_t;
+
+static const uint8_t ms_rates[MS_RATE_COUNT] PROGMEM = {10, 20, 40, 60, 80, 100, 200};
+
+/*
+ * After BAT the mouse is taken through this list one byte at a time, each
+ * waiting for its ACK.  The three rates up front are the IntelliMouse
+ * knock, after which a wheel mouse answers READ_ID with 3.  The last byte
+ * is replaced by the configured sample rate.
+ */
+static const uint8_t ms_setup[] PROGMEM = {PS2_MS_CMD_SET_SAMPLE, 200,
+                                           PS2_MS_CMD_SET_SAMPLE, 100,
+                                           PS2_MS_CMD_SET_SAMPLE, 80,
+                                           PS2_MS_CMD_READ_ID,
+                                           PS2_MS_CMD_SET_SAMPLE, 0
+                                          };
+
+#define MS_SETUP_ID           6
+#define MS_SETUP_RATE         (sizeof(ms_setup) - 1)
+
+static msstate_t ms_state;
+static uint8_t ms_step;
+static uint8_t ms_wheel;
+static uint16_t ms_sent;
+// motion not yet sent to the host
+static int16_t ms_x;
+static int16_t ms_y;
+static int8_t ms_z;
+static uint8_t ms_buttons;
+static uint8_t ms_clicks;
+static uint8_t ms_dirty;
+#ifdef UART0_CTS_SUPPORT
+static uint8_t ms_rts;
+#endif
+
+static void ms_send(uint8_t data) {
+  ps2_port_putc(PS2_MS_PORT, data);
+  ms_sent = timer_now();
+}
+
+static void ms_reset(void) {
+  ps2_port_set_packets(PS2_MS_PORT, 0);
+  ms_state = MS_ST_BAT;
+  ms_send(PS2_MS_CMD_RESET);
+}
+
+static void ms_next(void) {
+  uint8_t data;
+
+  if(ms_step > MS_SETUP_RATE) {
+    // packets start once this is ACKed.
+    ms_state = MS_ST_REPORT;
+    ms_send(PS2_MS_CMD_REPORT);
+    return;
+  }
+  if(ms_step == MS_SETUP_RATE)
+    data = pgm_read_byte(&ms_rates[ms_rate < MS_RATE_COUNT ? ms_rate : MS_RATE_100]);
+  else
+    data = pgm_read_byte(&ms_setup[ms_step]);
+  ms_state = MS_ST_ACK;
+  ms_send(data);
+}
+
+// the mouse is past BAT, set it up.  Skip the knock unless the host wants the wheel.
+static void ms_setup_mouse(void) {
+  ps2_port_set_packets(PS2_MS_PORT, 0);
+  ms_wheel = FALSE;
+  ms_step = (ms_proto == MS_PROTO_WHEEL ? 0 : MS_SETUP_ID);
+  ms_next();
+}
+
+static int16_t ms_clamp(int16_t val, int16_t max) {
+  if(val > max)
+    return max;
+  if(val < -max)
+    return -max;
+  return val;
+}
+
+/*
+ * Microsoft: 1 L R Y7 Y6 X7 X6, then X5-0 and Y5-0, Y grows downwards.
+ * The wheel variant adds M and a 4 bit wheel delta.  Mouse Systems: a
+ * sync byte with active low L M R, then two X/Y pairs, Y grows upwards.
+ */
+static void ms_packet(int8_t x, int8_t y, int8_t z, uint8_t buttons) {
+  if(ms_proto == MS_PROTO_MOUSESYS) {
+    uart_putc(0x80 | (buttons & PS2_MS_LEFT ? 0 : 0x04)
+                 | (buttons & PS2_MS_MIDDLE ? 0 : 0x02)
+                 | (buttons & PS2_MS_RIGHT ? 0 : 0x01));
+    uart_putc(x);
+    uart_putc(y);
+    uart_putc(0);
+    uart_putc(0);
+    return;
+  }
+  y = -y;
+  uart_putc(0x40 | (buttons & PS2_MS_LEFT ? 0x20 : 0)
+               | (buttons & PS2_MS_RIGHT ? 0x10 : 0)
+               | (((uint8_t)y & 0xc0) >> 4)
+               | (((uint8_t)x & 0xc0) >> 6));
+  uart_putc(x & 0x3f);
+  uart_putc(y & 0x3f);
+  if(ms_proto == MS_PROTO_WHEEL)
+    uart_putc((buttons & PS2_MS_MIDDLE ? 0x10 : 0) | (z & 0x0f));
+}
+
+/*
+ * 1200 bps only carries 40 or so packets a second, so motion builds up
+ * here and goes out as one packet whenever the UART has drained.  A click
+ * that came and went in between is still sent, then released.
+ */
+static void ms_report(uint8_t report) {
+  ps2motion_t m;
+  uint8_t flags;
+  int8_t x, y, z;
+
+  flags = ps2_port_get_motion(PS2_MS_PORT, &m);
+  if(flags & PS2_MS_REPLUGGED) {
+    ms_setup_mouse();
+    return;
+  }
+  if(!report || !ms_serial()) {
+    ms_dirty = FALSE;
+    return;
+  }
+  if(flags & PS2_MS_MOVED) {
+    ms_x = ms_clamp(ms_x + m.x, PS2_MS_LIMIT);
+    ms_y = ms_clamp(ms_y + m.y, PS2_MS_LIMIT);
+    ms_z = ms_clamp(ms_z + m.z, 7);
+    ms_clicks |= m.clicked & (uint8_t)~m.buttons;
+    ms_buttons = m.buttons;
+    ms_dirty = TRUE;
+  }
+  if(!ms_dirty || !uart_tx_idle())
+    return;
+  x = ms_clamp(ms_x, 127);
+  y = ms_clamp(ms_y, 127);
+  z = ms_z;
+  ms_packet(x, y, z, ms_buttons | ms_clicks);
+  ms_x -= x;
+  ms_y -= y;
+  ms_z = 0;
+  ms_dirty = (ms_x || ms_y || ms_clicks);
+  ms_clicks = 0;
+}
+
+#ifdef UART0_CTS_SUPPORT
+/*
+ * The host pulses RTS, which we see on CTS, to reset a serial mouse and
+ * then looks for its ID.  Only sample it here, the CTS IRQ wakes us.
+ */
+static void ms_check_rts(void) {
+  uint8_t rts = uart_cts();
+
+  if(!ms_serial())
+    return;
+  if(rts && !ms_rts) {
+    ms_x = 0;
+    ms_y = 0;
+    ms_z = 0;
+    ms_dirty = FALSE;
+    if(ms_proto != MS_PROTO_MOUSESYS)
+      uart_putc('M');
+    if(ms_proto == MS_PROTO_WHEEL) {
+      uart_putc('Z');
+      uart_putc('@');
+    }
+  }
+  ms_rts = rts;
+  if(!rts)
+    uart_cts_irq_on();
+}
+#else
+#  define ms_check_rts()      do {} while(0)
+#endif
+
+void ms_task(uint8_t report) {
+  uint8_t data;
+
+  while(ps2_port_data_available(PS2_MS_PORT)) {
+    data = ps2_port_getc(PS2_MS_PORT);
+    switch(ms_state) {
+    case MS_ST_BAT:
+      // ACK of the reset first, then BAT.  BAT also comes from a hot plug.
+      if(data == PS2_CMD_BAT)
+        ms_state = MS_ST_BAT_ID;
+      break;
+    case MS_ST_BAT_ID:
+      ms_setup_mouse();
+      break;
+    case MS_ST_ACK:
+      if(data != PS2_CMD_ACK) {
+        ms_reset();
+      } else if(ms_step == MS_SETUP_ID) {
+        ms_state = MS_ST_ID;
+      } else {
+        ms_step++;
+        ms_next();
+      }
+      break;
+    case MS_ST_ID:
+      ms_wheel = (data == PS2_MS_ID_WHEEL);
+      ms_step++;
+      ms_next();
+      break;
+    case MS_ST_REPORT:
+      if(data != PS2_CMD_ACK) {
+        ms_reset();
+      } else {
+        // from here on, bytes are packets and never reach the queue.
+        ps2_port_set_packets(PS2_MS_PORT, (ms_wheel ? 4 : 3));
+        ms_state = MS_ST_RUN;
+      }
+      break;
+    default:
+      break;
+    }
+  }
+  if(ms_state == MS_ST_RUN)
+    ms_report(report);
+  else if((uint16_t)(timer_now() - ms_sent) >= (ms_state == MS_ST_BAT ? MS_RESET_TIMEOUT : MS_CMD_TIMEOUT))
+    ms_reset();
+  ms_check_rts();
+}
+
+uint8_t ms_events(void) {
+  return (ps2_port_data_available(PS2_MS_PORT)
+          || ps2_port_motion_pending(PS2_MS_PORT)
+          || (ms_dirty && uart_tx_idle()));
+}
+
+void ms_uart_config(void) {
+  uart_config(CALC_BPS(1200),
+              (ms_proto == MS_PROTO_MOUSESYS ? LENGTH_8 : LENGTH_7),
+              PARITY_NONE,
+              STOP_0);
+  uart_set_flow(FLOW_NONE);
+}
+
+// sample rate or protocol changed, take the mouse through setup again.
+void ms_restart(void) {
+  ms_dirty = FALSE;
+  ms_reset();
+}
+
+void ms_init(void) {
+  ps2_port_init(PS2_MS_PORT, PS2_MODE_HOST);
+  ms_reset();
+}
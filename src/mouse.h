@@ -0,0 +1,63 @@
+/*
+    PS2Encoder - PS2 Keyboard to serial/parallel converter
+    Copyright Jim Brain and RETRO Innovations, 2008-2012
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+    mouse.h: public functions for the PS/2 mouse to serial mouse converter
+
+*/
+
+#ifndef MOUSE_H
+#define MOUSE_H
+
+/* Values for ms_proto, what the UART sends to the host */
+#define MS_PROTO_OFF          0   // UART carries keyboard output
+#define MS_PROTO_MICROSOFT    1   // 1200 7N1, 3 bytes
+#define MS_PROTO_WHEEL        2   // 1200 7N1, 4 bytes with middle button and wheel
+#define MS_PROTO_MOUSESYS     3   // 1200 8N1, 5 bytes
+#define MS_PROTO_COUNT        4
+
+/* Values for ms_rate, an index into the PS/2 sample rates */
+#define MS_RATE_10            0
+#define MS_RATE_20            1
+#define MS_RATE_40            2
+#define MS_RATE_60            3
+#define MS_RATE_80            4
+#define MS_RATE_100           5
+#define MS_RATE_200           6
+#define MS_RATE_COUNT         7
+
+// BAT can take 500ms, then the mouse is probed again about once a second
+#define MS_RESET_TIMEOUT      TIMER_MS(1000)
+#define MS_CMD_TIMEOUT        TIMER_MS(30)
+
+#ifdef PS2_MOUSE_SUPPORT
+void ms_init(void);
+void ms_restart(void);
+void ms_task(uint8_t report);
+uint8_t ms_events(void);
+void ms_uart_config(void);
+#  define ms_serial()         (ms_proto != MS_PROTO_OFF)
+#else
+#  define ms_init()           do {} while(0)
+#  define ms_restart()        do {} while(0)
+#  define ms_task(report)     do {} while(0)
+#  define ms_events()         FALSE
+#  define ms_uart_config()    do {} while(0)
+#  define ms_serial()         FALSE
+#endif
+
+#endif
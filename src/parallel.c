@@ -0,0 +1,148 @@
+/*
+    PS2Encoder - PS2 Keyboard to serial/parallel converter
+    Copyright Jim Brain and RETRO Innovations, 2008-2012
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+    parallel.c: Interrupt driven parallel output port
+
+    Bytes are queued and clocked out from the timer IRQ, so strobe width,
+    holdoff and the BUSY handshake never stall the caller or the UART.
+*/
+
+#include <inttypes.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include "config.h"
+#include "flags.h"
+#include "parallel.h"
+
+static uint8_t buf[1 << PAR_BUFFER_SHIFT];
+static volatile uint8_t head;
+static volatile uint8_t tail;
+
+static volatile parstate_t par_state;
+
+static void par_enable_timer(uint16_t us) {
+  uint16_t ticks = PAR_US(us);
+
+  if(ticks < PAR_US(PAR_MIN_PERIOD))
+    ticks = PAR_US(PAR_MIN_PERIOD);
+  // clear flag.  Write 1 to clear, TOV1 of the timebase shares the register.
+  PAR_TIFR = PAR_TIFR_DATA;
+  // timer free runs, so schedule relative to now.
+  PAR_OCR = PAR_TCNT + ticks;
+  // enable output compare IRQ
+  PAR_TIMSK |= PAR_TIMSK_DATA;
+}
+
+static void par_disable_timer(void) {
+  // disable output compare IRQ
+  PAR_TIMSK &= (uint8_t)~PAR_TIMSK_DATA;
+}
+
+static void par_strobe_on(void) {
+  if(globalopts & OPT_STROBE_LO)
+    data_strobe_lo();
+  else
+    data_strobe_hi();
+}
+
+static void par_strobe_off(void) {
+  if(globalopts & OPT_STROBE_LO)
+    data_strobe_hi();
+  else
+    data_strobe_lo();
+}
+
+static void par_check_for_data(void) {
+  // do we have data to send?
+  if(head == tail) {
+    par_state = PAR_ST_IDLE;
+    par_disable_timer();
+  } else if((globalopts & OPT_HANDSHAKE) && data_busy()) {
+    // target not ready, look again shortly.
+    par_state = PAR_ST_BUSY;
+    par_enable_timer(PAR_BUSY_POLL);
+  } else {
+    tail = (tail + 1) & PAR_BUFFER_MASK;
+    data_out(buf[tail]);
+    par_strobe_on();
+    par_state = PAR_ST_STROBE;
+    par_enable_timer(pulselen);
+  }
+}
+
+ISR(PAR_TIMER_COMP_vect) {
+  switch(par_state) {
+    case PAR_ST_STROBE:
+      par_strobe_off();
+      if(holdoff) {
+        par_state = PAR_ST_HOLDOFF;
+        par_enable_timer(holdoff * 10);
+      } else {
+        par_check_for_data();
+      }
+      break;
+    case PAR_ST_HOLDOFF:
+    case PAR_ST_BUSY:
+      par_check_for_data();
+      break;
+    default:
+      par_disable_timer();
+      break;
+  }
+}
+
+void par_putc(uint8_t data) {
+  uint8_t tmphead;
+
+  // Calculate buffer index
+  tmphead = (head + 1) & PAR_BUFFER_MASK;
+  while(tmphead == tail) {
+    // Wait for free space in buffer
+    ;
+  }
+  // Store data in buffer
+  buf[tmphead] = data;
+  // Store new index
+  head = tmphead;
+
+  // turn off IRQs
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if(par_state == PAR_ST_IDLE) {
+      // start transmission;
+      par_check_for_data();
+    }
+  }
+}
+
+uint8_t par_free(void) {
+  return (((head + 1) & PAR_BUFFER_MASK) != tail); /* Return 0 (FALSE) if the buffer is full */
+}
+
+void par_clear_buffers(void) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    head = 0;
+    tail = 0;
+  }
+}
+
+void par_init(void) {
+  par_init_timer();
+  par_clear_buffers();
+  par_state = PAR_ST_IDLE;
+}
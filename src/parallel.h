@@ -0,0 +1,85 @@
+/*
+    PS2Encoder - PS2 Keyboard to serial/parallel converter
+    Copyright Jim Brain and RETRO Innovations, 2008-2012
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+    parallel.h: public functions for the queued parallel output port
+
+*/
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#ifndef PAR_BUFFER_SHIFT
+#  define PAR_BUFFER_SHIFT    5
+#endif
+
+#define PAR_BUFFER_MASK       (_BV(PAR_BUFFER_SHIFT) - 1)
+
+// while the target asserts BUSY, check again this often (uS)
+#define PAR_BUSY_POLL         50
+// shortest timer period we can safely schedule (uS)
+#define PAR_MIN_PERIOD        8
+
+/*
+ * Timer1 free runs at F_CPU/8 and is never reset, so other code can use
+ * TCNT1 as a timebase.  The parallel port paces itself with compare A.
+ */
+#if defined __AVR_ATmega8__ || defined __AVR_ATmega16__ || defined __AVR_ATmega32__ || defined __AVR_ATmega162__
+
+#  define PAR_TIMSK             TIMSK
+#  define PAR_TIFR              TIFR
+
+#elif defined __AVR_ATmega28__ || defined __AVR_ATmega48__ || defined __AVR_ATmega88__ || defined __AVR_ATmega168__ || defined __AVR_ATmega328__
+
+#  define PAR_TIMSK             TIMSK1
+#  define PAR_TIFR              TIFR1
+
+#else
+#  error Unknown chip!
+#endif
+
+#define PAR_TIMER_COMP_vect     TIMER1_COMPA_vect
+#define PAR_OCR                 OCR1A
+#define PAR_TCNT                TCNT1
+#define PAR_TCCR1               TCCR1B
+#define PAR_TCCR1_DATA          _BV(CS11)
+#define PAR_TIFR_DATA           _BV(OCF1A)
+#define PAR_TIMSK_DATA          _BV(OCIE1A)
+
+#if F_CPU >= 8000000
+#  define PAR_US(x)             ((uint16_t)(x) * (uint16_t)(F_CPU / 8000000UL))
+#else
+#  define PAR_US(x)             ((uint16_t)(x) / (uint16_t)(8000000UL / F_CPU))
+#endif
+
+typedef enum {PAR_ST_IDLE
+             ,PAR_ST_STROBE
+             ,PAR_ST_HOLDOFF
+             ,PAR_ST_BUSY
+             } parstate_t;
+
+static inline __attribute__((always_inline)) void par_init_timer(void) {
+  // normal mode, set prescaler to System Clock/8
+  PAR_TCCR1 |= PAR_TCCR1_DATA;
+}
+
+void par_init(void);
+void par_putc(uint8_t data);
+uint8_t par_free(void);
+void par_clear_buffers(void);
+
+#endif
@@ -30,207 +30,384 @@
 #include "ps2.h"
 #include "uart.h"
 
-static uint8_t rxbuf[1 << PS2_RX_BUFFER_SHIFT];
-static volatile uint8_t rx_head;
-static volatile uint8_t rx_tail;
-static uint8_t txbuf[1 << PS2_TX_BUFFER_SHIFT];
-static volatile uint8_t tx_head;
-static volatile uint8_t tx_tail;
-
-static volatile ps2state_t ps2_state;
-static volatile uint8_t ps2_byte;
-static volatile uint8_t ps2_bit_count;
-static volatile uint8_t ps2_parity;
-
-static ps2mode_t ps2_mode;
+/*
+ * All port state lives in ps2_port[].  Every helper below is always
+ * inlined and each ISR passes a constant port number, so the compiler
+ * resolves the pins and the state addresses at build time.  A port's
+ * ISR costs the same as it did with file-scope statics.
+ */
+typedef struct {
+  uint8_t rxbuf[1 << PS2_RX_BUFFER_SHIFT];
+  volatile uint8_t rx_head;
+  volatile uint8_t rx_tail;
+  uint8_t txbuf[1 << PS2_TX_BUFFER_SHIFT];
+  volatile uint8_t tx_head;
+  volatile uint8_t tx_tail;
+
+  volatile ps2state_t state;
+  volatile uint8_t byte;
+  volatile uint8_t bit_count;
+  volatile uint8_t parity;
+  volatile uint8_t holdoff_count;
+
+  ps2mode_t mode;
+
+  // device mode bit timing, see ps2_port_set_timing()
+  uint8_t half_cycle;
+  uint8_t send_holdoff;
+  uint8_t holdoff_max;
+  uint8_t adaptive;
+  uint8_t sent_ok;
+#if PS2_PORTS > 1
+  // pin change IRQs fire on both edges, this is the one we want.
+  volatile uint8_t clk_rise;
+#endif
+#ifdef PS2_KB_MERGE
+  // arrival stamp of each byte in rxbuf
+  uint8_t rxstamp[1 << PS2_RX_BUFFER_SHIFT];
+#endif
+#ifdef PS2_MOUSE_SUPPORT
+  // mouse packets are put together in the IRQ, only the sums are kept.
+  uint8_t pkt_len;
+  uint8_t pkt_count;
+  uint8_t pkt[3];
+  volatile uint8_t ms_flags;
+  int16_t ms_x;
+  int16_t ms_y;
+  int8_t ms_z;
+  uint8_t ms_buttons;
+  uint8_t ms_clicked;
+#endif
+} ps2port_t;
 
-static volatile uint8_t ps2_holdoff_count;
+static ps2port_t ps2_port[PS2_PORTS];
+#ifdef PS2_KB_MERGE
+// counts received bytes over all ports.  IRQs do not nest, so no locking.
+static uint8_t ps2_rx_count;
+#endif
 
-static void ps2_enable_clk_rise(void) {
+static inline __attribute__((always_inline)) void ps2_enable_clk_rise(uint8_t p) {
+  if(p) {
+#if PS2_PORTS > 1
+    ps2_port[1].clk_rise = TRUE;
+    // write 1 to clear, a read-modify-write would clear the CTS flag too
+    PS2_1_CLK_PCIFR = PS2_1_CLK_PCIF;
+    PS2_1_CLK_PCMSK |= PS2_1_CLK_PCINT;
+    PS2_1_CLK_PCICR |= PS2_1_CLK_PCIE;
+#endif
+    return;
+  }
   // turn off IRQ
   CLK_INTCR &= (uint8_t)~_BV(CLK_INT);
   // reset flag
-  CLK_INTFR |= _BV(CLK_INTF);
+  CLK_INTFR = _BV(CLK_INTF);
   // rising edge
   CLK_INTDR |= _BV(CLK_ISC1) | _BV(CLK_ISC0);
   // turn on
   CLK_INTCR |= _BV(CLK_INT);
 }
 
-static void ps2_enable_clk_fall(void) {
+static inline __attribute__((always_inline)) void ps2_enable_clk_fall(uint8_t p) {
+  if(p) {
+#if PS2_PORTS > 1
+    ps2_port[1].clk_rise = FALSE;
+    // write 1 to clear, a read-modify-write would clear the CTS flag too
+    PS2_1_CLK_PCIFR = PS2_1_CLK_PCIF;
+    PS2_1_CLK_PCMSK |= PS2_1_CLK_PCINT;
+    PS2_1_CLK_PCICR |= PS2_1_CLK_PCIE;
+#endif
+    return;
+  }
   // turn off IRQ
   CLK_INTCR &= (uint8_t)~_BV(CLK_INT);
   // reset flag
-  CLK_INTFR |= _BV(CLK_INTF);
+  CLK_INTFR = _BV(CLK_INTF);
   // falling edge
   CLK_INTDR = (CLK_INTDR & (uint8_t)~(_BV(CLK_ISC1) | _BV(CLK_ISC0))) | _BV(CLK_ISC1);
   // turn on
   CLK_INTCR |= _BV(CLK_INT);
 }
 
-static void ps2_disable_clk(void) {
+static inline __attribute__((always_inline)) void ps2_disable_clk(uint8_t p) {
+  if(p) {
+#if PS2_PORTS > 1
+    PS2_1_CLK_PCMSK &= (uint8_t)~PS2_1_CLK_PCINT;
+    PS2_1_CLK_PCICR &= (uint8_t)~PS2_1_CLK_PCIE;
+#endif
+    return;
+  }
   CLK_INTCR &= (uint8_t)~_BV(CLK_INT);
 }
 
-static void ps2_enable_timer(uint8_t us) {
-  // clear flag.
-  PS2_TIFR |= PS2_TIFR_DATA;
-  // clear TCNT;
-  PS2_TCNT = 0;
-  // set the count...
+/*
+ * One compare channel of the PS/2 timer per port.  With one port the
+ * timer runs in CTC mode and restarts from 0, with two it free runs and
+ * each channel is set relative to the current count.
+ */
+static inline __attribute__((always_inline)) uint8_t ps2_us_ticks(uint8_t us) {
 #if F_CPU > 14000000
   // us is uS....  Need to * 14 to get ticks, then divide by 8...
   // cheat... * 14 / 8 = *2 = <<1
-  PS2_OCR = (uint8_t)(us << 1);
+  return (uint8_t)(us << 1);
 #elif F_CPU > 7000000
-  PS2_OCR = us;
+  return us;
+#else
+  return (us >> 1);
+#endif
+}
+
+static inline __attribute__((always_inline)) void ps2_enable_timer(uint8_t p, uint8_t us) {
+  uint8_t ticks = ps2_us_ticks(us);
+
+  if(p) {
+#if PS2_PORTS > 1
+    // the ports share TIFR, only clear our own flag.
+    PS2_TIFR = PS2_1_TIFR_DATA;
+    PS2_1_OCR = PS2_TCNT + ticks;
+    PS2_TIMSK |= PS2_1_TIMSK_DATA;
+#endif
+    return;
+  }
+#if PS2_PORTS > 1
+  // clear flag, write 1 to clear only this one.
+  PS2_TIFR = PS2_TIFR_DATA;
+  PS2_OCR = PS2_TCNT + ticks;
 #else
-  PS2_OCR = (us >> 1);
+  // clear flag, write 1 to clear only this one.
+  PS2_TIFR = PS2_TIFR_DATA;
+  // clear TCNT;
+  PS2_TCNT = 0;
+  // set the count...
+  PS2_OCR = ticks;
 #endif
   // enable output compare IRQ
   PS2_TIMSK |= PS2_TIMSK_DATA;
 }
 
-static void ps2_disable_timer(void) {
+#if PS2_PORTS > 1
+/*
+ * Device mode ticks every half cycle.  CTC did that by itself, but with
+ * two ports the timer free runs, so move the compare on by a half cycle.
+ * States that arm or stop the timer themselves override this.
+ */
+static inline __attribute__((always_inline)) void ps2_next_tick(uint8_t p) {
+  uint8_t ticks = ps2_us_ticks(ps2_port[p].half_cycle);
+
+  if(p)
+    PS2_1_OCR += ticks;
+  else
+    PS2_OCR += ticks;
+}
+#endif
+
+static inline __attribute__((always_inline)) void ps2_disable_timer(uint8_t p) {
+  if(p) {
+#if PS2_PORTS > 1
+    PS2_TIMSK &= (uint8_t)~PS2_1_TIMSK_DATA;
+#endif
+    return;
+  }
   // disable output compare IRQ
   PS2_TIMSK &= (uint8_t)~PS2_TIMSK_DATA;
 }
 
-static void ps2_write_byte(void) {
+static inline __attribute__((always_inline)) void ps2_write_byte(uint8_t p) {
   uint8_t tmp;
   /* Calculate buffer index */
-  tmp = ( rx_head + 1 ) & PS2_RX_BUFFER_MASK;
-  rx_head = tmp;      /* Store new index */
+  tmp = ( ps2_port[p].rx_head + 1 ) & PS2_RX_BUFFER_MASK;
+  ps2_port[p].rx_head = tmp;      /* Store new index */
 
-  if ( tmp == rx_tail ) {
+  if ( tmp == ps2_port[p].rx_tail ) {
     /* ERROR! Receive buffer overflow */
   }
-  rxbuf[tmp] = ps2_byte; /* Store received data in buffer */
+  ps2_port[p].rxbuf[tmp] = ps2_port[p].byte; /* Store received data in buffer */
+#ifdef PS2_KB_MERGE
+  ps2_port[p].rxstamp[tmp] = ps2_rx_count++;
+#endif
 }
 
-static void ps2_read_byte(void) {
-  ps2_bit_count = 0;
-  ps2_parity = 0;
-  ps2_byte = txbuf[( tx_tail + 1 ) & PS2_TX_BUFFER_MASK];  /* Start transmition */
+#ifdef PS2_MOUSE_SUPPORT
+static inline __attribute__((always_inline)) int16_t ps2_ms_add(int16_t sum, uint8_t delta, uint8_t negative) {
+  sum += delta;
+  if(negative)
+    sum -= 256;
+  if(sum > PS2_MS_LIMIT)
+    return PS2_MS_LIMIT;
+  if(sum < -PS2_MS_LIMIT)
+    return -PS2_MS_LIMIT;
+  return sum;
 }
 
-static void ps2_commit_read_byte(void) {
-  tx_tail = ( tx_tail + 1 ) & PS2_TX_BUFFER_MASK;      /* Store new index */
+/*
+ * Mouse bytes are not queued.  Each packet is added to a running sum, so
+ * however far behind the reader falls, it picks up the current position
+ * and never works through stale packets.  ACK and RESEND look like
+ * headers, so they are dropped before they can start a packet.
+ */
+static inline __attribute__((always_inline)) void ps2_ms_collect(uint8_t p) {
+  uint8_t data = ps2_port[p].byte;
+  uint8_t i = ps2_port[p].pkt_count;
+  uint8_t hdr;
+  int8_t z;
+
+  if(!i && (!(data & PS2_MS_SYNC) || data == PS2_CMD_ACK || data == PS2_CMD_RESEND))
+    return;   // out of step or a command reply, wait for a header
+  if(i == 1 && ps2_port[p].pkt[0] == PS2_CMD_BAT && !data) {
+    // BAT and ID, the mouse was plugged in again and is not reporting.
+    ps2_port[p].pkt_count = 0;
+    ps2_port[p].ms_flags |= PS2_MS_REPLUGGED;
+    return;
+  }
+  if(++i < ps2_port[p].pkt_len) {
+    ps2_port[p].pkt[i - 1] = data;
+    ps2_port[p].pkt_count = i;
+    return;
+  }
+  ps2_port[p].pkt_count = 0;
+  hdr = ps2_port[p].pkt[0];
+  if(i == 4) {
+    z = ps2_port[p].ms_z + (int8_t)data;
+    // wheel moves are small, just stop before the sum wraps.
+    if((int8_t)data > 0 ? z > ps2_port[p].ms_z : z <= ps2_port[p].ms_z)
+      ps2_port[p].ms_z = z;
+    data = ps2_port[p].pkt[2];
+  }
+  if((hdr & (PS2_MS_X_OVF | PS2_MS_Y_OVF)) == (PS2_MS_X_OVF | PS2_MS_Y_OVF))
+    return;   // more likely a stray reply than a packet, trust none of it
+  if(!(hdr & (PS2_MS_X_OVF | PS2_MS_Y_OVF))) {
+    // 9 bit deltas, the sign bits are in the header.
+    ps2_port[p].ms_x = ps2_ms_add(ps2_port[p].ms_x, ps2_port[p].pkt[1], hdr & PS2_MS_X_SIGN);
+    ps2_port[p].ms_y = ps2_ms_add(ps2_port[p].ms_y, data, hdr & PS2_MS_Y_SIGN);
+  }
+  ps2_port[p].ms_buttons = hdr & PS2_MS_BUTTONS;
+  ps2_port[p].ms_clicked |= hdr & PS2_MS_BUTTONS;
+  ps2_port[p].ms_flags |= PS2_MS_MOVED;
 }
+#endif
 
-static void ps2_write_bit(void) {
-  ps2_state=PS2_ST_PREP_BIT;
+static inline __attribute__((always_inline)) void ps2_read_byte(uint8_t p) {
+  ps2_port[p].bit_count = 0;
+  ps2_port[p].parity = 0;
+  ps2_port[p].byte = ps2_port[p].txbuf[( ps2_port[p].tx_tail + 1 ) & PS2_TX_BUFFER_MASK];  /* Start transmition */
+}
+
+static inline __attribute__((always_inline)) void ps2_commit_read_byte(uint8_t p) {
+  ps2_port[p].tx_tail = ( ps2_port[p].tx_tail + 1 ) & PS2_TX_BUFFER_MASK;      /* Store new index */
+}
+
+static inline __attribute__((always_inline)) void ps2_write_bit(uint8_t p) {
+  ps2_port[p].state=PS2_ST_PREP_BIT;
   // set DATA..
-  switch (ps2_byte & 1) {
+  switch (ps2_port[p].byte & 1) {
     case 0:
-      ps2_clear_data();
+      ps2_clear_data(p);
       break;
     case 1:
-      ps2_parity++;
-      ps2_set_data();
+      ps2_port[p].parity++;
+      ps2_set_data(p);
       break;
   }
   // shift right.
-  ps2_byte= ps2_byte >> 1;
-  ps2_bit_count++;
+  ps2_port[p].byte= ps2_port[p].byte >> 1;
+  ps2_port[p].bit_count++;
   // valid data now.
 }
 
-static void ps2_read_bit(void) {
-  ps2_byte = ps2_byte >> 1;
-  ps2_bit_count++;
-  if(ps2_read_data()) {
-    ps2_byte |= 0x80;
-    ps2_parity++;
+static inline __attribute__((always_inline)) void ps2_read_bit(uint8_t p) {
+  ps2_port[p].byte = ps2_port[p].byte >> 1;
+  ps2_port[p].bit_count++;
+  if(ps2_read_data(p)) {
+    ps2_port[p].byte |= 0x80;
+    ps2_port[p].parity++;
   }
 }
 
-static void ps2_write_parity(void) {
-  if((ps2_parity & 1) == 1) {
-    ps2_clear_data();
+static inline __attribute__((always_inline)) void ps2_write_parity(uint8_t p) {
+  if((ps2_port[p].parity & 1) == 1) {
+    ps2_clear_data(p);
   } else {
-    ps2_set_data();
+    ps2_set_data(p);
   }
 }
 
-static void ps2_clear_counters(void) {
-  ps2_byte = 0;
-  ps2_bit_count = 0;
-  ps2_parity = 0;
+static inline __attribute__((always_inline)) void ps2_clear_counters(uint8_t p) {
+  ps2_port[p].byte = 0;
+  ps2_port[p].bit_count = 0;
+  ps2_port[p].parity = 0;
 }
 
-void ps2_clear_buffers(void) {
+void ps2_port_clear_buffers(uint8_t p) {
   ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-    tx_head = 0;
-    tx_tail = 0;
-    rx_head = 0;
-    rx_tail = 0;
+    ps2_port[p].tx_head = 0;
+    ps2_port[p].tx_tail = 0;
+    ps2_port[p].rx_head = 0;
+    ps2_port[p].rx_tail = 0;
   }
 }
 
 #ifdef PS2_ENABLE_DEVICE
-static void ps2_device_trigger_send(void) {
+static inline __attribute__((always_inline)) void ps2_device_trigger_send(uint8_t p) {
   // start clocking.
   // wait a half cycle
-  ps2_enable_timer(PS2_HALF_CYCLE);
+  ps2_enable_timer(p, ps2_port[p].half_cycle);
   // bring DATA line low to ensure everyone knows our intentions
-  ps2_clear_data();
+  ps2_clear_data(p);
 }
 #endif
 
 #ifdef PS2_ENABLE_HOST
-static void ps2_host_trigger_send(void) {
+static inline __attribute__((always_inline)) void ps2_host_trigger_send(uint8_t p) {
   // need to get devices attention...
-  ps2_disable_clk();
-  ps2_clear_clk();
+  ps2_disable_clk(p);
+  ps2_clear_clk(p);
   // yes, bring CLK lo for 100uS
-  ps2_enable_timer(100);
+  ps2_enable_timer(p, 100);
 }
 #endif
 
-static void ps2_trigger_send(void) {
+static inline __attribute__((always_inline)) void ps2_trigger_send(uint8_t p) {
   // set state
-  ps2_state = PS2_ST_PREP_START;
-  PS2_CALL(ps2_device_trigger_send(),ps2_host_trigger_send());
+  ps2_port[p].state = PS2_ST_PREP_START;
+  PS2_CALL(p, ps2_device_trigger_send(p),ps2_host_trigger_send(p));
 }
 
 
-static void ps2_check_for_data(void) {
+static inline __attribute__((always_inline)) void ps2_check_for_data(uint8_t p) {
   // do we have data to send?
-  if( tx_head != tx_tail) {
-    ps2_trigger_send();
+  if( ps2_port[p].tx_head != ps2_port[p].tx_tail) {
+    ps2_trigger_send(p);
   } else {
-    ps2_state = PS2_ST_IDLE;
-    ps2_disable_timer();  // TODO check if this is needed for host mode as well.
-    ps2_enable_clk_fall();
+    ps2_port[p].state = PS2_ST_IDLE;
+    ps2_disable_timer(p);  // TODO check if this is needed for host mode as well.
+    ps2_enable_clk_fall(p);
   }
 }
 
 #ifdef PS2_ENABLE_HOST
-static inline __attribute__((always_inline)) void ps2_host_timer_irq(void) {
-  ps2_disable_timer();
-  switch (ps2_state) {
+static inline __attribute__((always_inline)) void ps2_host_timer_irq(uint8_t p) {
+  ps2_disable_timer(p);
+  switch (ps2_port[p].state) {
     case PS2_ST_GET_BIT:
     case PS2_ST_GET_PARITY:
     case PS2_ST_GET_STOP:
       // do we have data to send to keyboard?
-      ps2_check_for_data();
+      ps2_check_for_data(p);
       break;
     case PS2_ST_PREP_START:
       // we waited 100uS for device to notice us, bring DATA low and CLK hi
-      ps2_clear_data();
-      ps2_set_clk();
-      if(!ps2_read_clk()) {
+      ps2_clear_data(p);
+      ps2_set_clk(p);
+      if(!ps2_read_clk(p)) {
         // kb wants to talk to us.
-        ps2_set_data();
-        ps2_enable_clk_fall();
-        ps2_state = PS2_ST_GET_BIT;
+        ps2_set_data(p);
+        ps2_enable_clk_fall(p);
+        ps2_port[p].state = PS2_ST_GET_BIT;
       } else {
         // really start bit...
         // now, wait for falling CLK
-        ps2_enable_clk_fall();
-        ps2_state = PS2_ST_PREP_BIT;
-        ps2_read_byte();
+        ps2_enable_clk_fall(p);
+        ps2_port[p].state = PS2_ST_PREP_BIT;
+        ps2_read_byte(p);
       }
       break;
     default:
@@ -239,77 +416,82 @@ static inline __attribute__((always_inline)) void ps2_host_timer_irq(void) {
 }
 
 
-static inline __attribute__((always_inline)) void ps2_host_clk_irq(void) {
-  switch(ps2_state) {
+static inline __attribute__((always_inline)) void ps2_host_clk_irq(uint8_t p) {
+  switch(ps2_port[p].state) {
     case PS2_ST_WAIT_RESPONSE:
     case PS2_ST_IDLE:
       // keyboard sent start bit
       // should read it, but will assume it is good.
-      ps2_state = PS2_ST_GET_BIT;
+      ps2_port[p].state = PS2_ST_GET_BIT;
       // if we don't get another CLK in 100uS, timeout.
-      ps2_enable_timer(100);
-      ps2_clear_counters();
+      ps2_enable_timer(p, 100);
+      ps2_clear_counters(p);
       break;
     case PS2_ST_GET_BIT:
       // if we don't get another CLK in 100uS, timeout.
-      ps2_enable_timer(100);
+      ps2_enable_timer(p, 100);
       // read bit;
-      ps2_read_bit();
-      if(ps2_bit_count == 8) {
+      ps2_read_bit(p);
+      if(ps2_port[p].bit_count == 8) {
         // done, do Parity bit
-        ps2_state = PS2_ST_GET_PARITY;
+        ps2_port[p].state = PS2_ST_GET_PARITY;
       }
       break;
     case PS2_ST_GET_PARITY:
       // if we don't get another CLK in 100uS, timeout.
-      ps2_enable_timer(100);
+      ps2_enable_timer(p, 100);
       // grab parity
       // for now, assume it is OK.
-      ps2_state = PS2_ST_GET_STOP;
+      ps2_port[p].state = PS2_ST_GET_STOP;
       break;
     case PS2_ST_GET_STOP:
-      ps2_disable_timer();
+      ps2_disable_timer(p);
       // stop bit
       // for now, assume it is OK.
-      ps2_write_byte();
+#ifdef PS2_MOUSE_SUPPORT
+      if(p == PS2_MS_PORT && ps2_port[p].pkt_len)
+        ps2_ms_collect(p);
+      else
+#endif
+      ps2_write_byte(p);
       // wait for CLK to rise before doing anything else.
-      ps2_state = PS2_ST_HOLDOFF;
-      ps2_enable_clk_rise();
+      ps2_port[p].state = PS2_ST_HOLDOFF;
+      ps2_enable_clk_rise(p);
       break;
     case PS2_ST_HOLDOFF:
       // CLK rose, so now, check for more data.
       // do we have data to send to keyboard?
-      ps2_check_for_data();
+      ps2_check_for_data(p);
       break;
 //    case PS2_ST_SEND_START:
-//      ps2_state = PS2_ST_PREP_BIT;
+//      ps2_port[p].state = PS2_ST_PREP_BIT;
 //      break;
     case PS2_ST_PREP_BIT:
       // time to send bits...
-      if(ps2_bit_count == 8) {
+      if(ps2_port[p].bit_count == 8) {
         // we are done..., do parity
-        ps2_write_parity();
-        ps2_state = PS2_ST_SEND_PARITY;
+        ps2_write_parity(p);
+        ps2_port[p].state = PS2_ST_SEND_PARITY;
       } else {
-        ps2_write_bit();
+        ps2_write_bit(p);
       }
       break;
     case PS2_ST_SEND_PARITY:
       // send stop bit.
-      ps2_set_data();
-      ps2_state = PS2_ST_SEND_STOP;
+      ps2_set_data(p);
+      ps2_port[p].state = PS2_ST_SEND_STOP;
       break;
     case PS2_ST_SEND_STOP:
-      if(!ps2_read_data()) {
+      if(!ps2_read_data(p)) {
         // commit the send
-        ps2_commit_read_byte();
+        ps2_commit_read_byte(p);
         /*
          * We could wait for the CLK hi, then check to see if we have more
          * data to send.  However, all cmds out have a required ack or response
          * so we'll just set to a non-IDLE state and wait for the CLK
          */
-        ps2_state = PS2_ST_WAIT_RESPONSE;
-        ps2_enable_clk_fall();
+        ps2_port[p].state = PS2_ST_WAIT_RESPONSE;
+        ps2_enable_clk_fall(p);
       } else {
         // wait for another cycle.  We should timeout here, I think
       }
@@ -319,211 +501,237 @@ static inline __attribute__((always_inline)) void ps2_host_clk_irq(void) {
   }
 }
 
-static void ps2_host_init(void) {
+static inline __attribute__((always_inline)) void ps2_host_init(void) {
 }
 #endif
 
 #ifdef PS2_ENABLE_DEVICE
-static void ps2_device_host_inhibit(void) {
+/*
+ * Adaptive holdoff: every PS2_ADAPT_BYTES clean bytes, shorten the gap
+ * between bytes by a half cycle.  If the host inhibits us while we send,
+ * it could not keep up, so double the gap, up to the configured one.
+ */
+static inline __attribute__((always_inline)) void ps2_device_sent(uint8_t p) {
+  if(ps2_port[p].adaptive && ++ps2_port[p].sent_ok >= PS2_ADAPT_BYTES) {
+    ps2_port[p].sent_ok = 0;
+    if(ps2_port[p].send_holdoff > PS2_SEND_HOLDOFF_MIN)
+      ps2_port[p].send_holdoff--;
+  }
+}
+
+static inline __attribute__((always_inline)) void ps2_device_backoff(uint8_t p) {
+  if(ps2_port[p].adaptive) {
+    ps2_port[p].sent_ok = 0;
+    ps2_port[p].send_holdoff = (ps2_port[p].send_holdoff < ps2_port[p].holdoff_max / 2 ? ps2_port[p].send_holdoff << 1 : ps2_port[p].holdoff_max);
+  }
+}
+
+static inline __attribute__((always_inline)) void ps2_device_host_inhibit(uint8_t p) {
+  if(ps2_port[p].state >= PS2_ST_PREP_START && ps2_port[p].state <= PS2_ST_SEND_STOP)
+    ps2_device_backoff(p);
   // CLK is low.  Host wants to talk to us.
   // turn off timer
-  ps2_disable_timer();
+  ps2_disable_timer(p);
   // look for rising clock
-  ps2_enable_clk_rise();
-  ps2_state = PS2_ST_HOST_INHIBIT;
+  ps2_enable_clk_rise(p);
+  ps2_port[p].state = PS2_ST_HOST_INHIBIT;
   // release DATA line, if we happen to have it.
-  ps2_set_data();
+  ps2_set_data(p);
 }
 
 
-static inline __attribute__((always_inline)) void ps2_device_timer_irq(void) {
-  switch (ps2_state) {
+static inline __attribute__((always_inline)) void ps2_device_timer_irq(uint8_t p) {
+#if PS2_PORTS > 1
+  ps2_next_tick(p);
+#endif
+  switch (ps2_port[p].state) {
     case PS2_ST_PREP_START:
       // clk the start bit, which is already been cleared.
-      ps2_clear_clk();
-      ps2_state = PS2_ST_SEND_START;
+      ps2_clear_clk(p);
+      ps2_port[p].state = PS2_ST_SEND_START;
       break;
     case PS2_ST_SEND_START:
-      ps2_read_byte();
-      ps2_set_clk();  // bring CLK hi
-      if(ps2_read_clk()) {
-        ps2_write_bit();
+      ps2_read_byte(p);
+      ps2_set_clk(p);  // bring CLK hi
+      if(ps2_read_clk(p)) {
+        ps2_write_bit(p);
       } else {
-        ps2_device_host_inhibit();
+        ps2_device_host_inhibit(p);
       }
       break;
     case PS2_ST_PREP_BIT:
-      ps2_clear_clk();
-      ps2_state = PS2_ST_SEND_BIT;
+      ps2_clear_clk(p);
+      ps2_port[p].state = PS2_ST_SEND_BIT;
       break;
     case PS2_ST_SEND_BIT:
-      ps2_set_clk();  // bring CLK hi
-      if(ps2_read_clk()) {
-        if(ps2_bit_count == 8) {
+      ps2_set_clk(p);  // bring CLK hi
+      if(ps2_read_clk(p)) {
+        if(ps2_port[p].bit_count == 8) {
           // we are done..., do parity
-          ps2_write_parity();
-          ps2_state = PS2_ST_PREP_PARITY;
+          ps2_write_parity(p);
+          ps2_port[p].state = PS2_ST_PREP_PARITY;
         } else {
           // state is set in function.
-          ps2_write_bit();
+          ps2_write_bit(p);
         }
       } else {
-        ps2_device_host_inhibit();
+        ps2_device_host_inhibit(p);
       }
       break;
     case PS2_ST_PREP_PARITY:
       // clock parity
-      ps2_clear_clk();
-      ps2_state = PS2_ST_SEND_PARITY;
+      ps2_clear_clk(p);
+      ps2_port[p].state = PS2_ST_SEND_PARITY;
       break;
     case PS2_ST_SEND_PARITY:
-      ps2_set_clk();  // bring CLK hi
-      if(ps2_read_clk()) {
-        ps2_set_data();
-        ps2_state = PS2_ST_PREP_STOP;
+      ps2_set_clk(p);  // bring CLK hi
+      if(ps2_read_clk(p)) {
+        ps2_set_data(p);
+        ps2_port[p].state = PS2_ST_PREP_STOP;
       } else {
-        ps2_device_host_inhibit();
+        ps2_device_host_inhibit(p);
       }
       break;
     case PS2_ST_PREP_STOP:
-      ps2_clear_clk();
-      ps2_state = PS2_ST_SEND_STOP;
+      ps2_clear_clk(p);
+      ps2_port[p].state = PS2_ST_SEND_STOP;
       break;
     case PS2_ST_SEND_STOP:
       // If host wanted to abort, they had to do it before now.
-      ps2_commit_read_byte();
-      ps2_set_clk();  // bring CLK hi
-      if(ps2_read_clk()) {
-        if(ps2_read_data()) {
+      ps2_commit_read_byte(p);
+      ps2_set_clk(p);  // bring CLK hi
+      if(ps2_read_clk(p)) {
+        if(ps2_read_data(p)) {
           // for some reason, you have to wait a while before sending again.
-          ps2_holdoff_count=PS2_SEND_HOLDOFF_COUNT;
-          ps2_state = PS2_ST_HOLDOFF;
+          ps2_device_sent(p);
+          ps2_port[p].holdoff_count = ps2_port[p].send_holdoff;
+          ps2_port[p].state = PS2_ST_HOLDOFF;
         } else {
           // Host wants to talk to us.
-          ps2_state = PS2_ST_WAIT_START;
+          ps2_port[p].state = PS2_ST_WAIT_START;
         }
       } else {
-        ps2_device_host_inhibit();
+        ps2_device_host_inhibit(p);
       }
       break;
     case PS2_ST_WAIT_START:
       // set CLK lo
-      ps2_clear_clk();
-      ps2_clear_counters();
+      ps2_clear_clk(p);
+      ps2_clear_counters(p);
       // read start bit
-      if(ps2_read_data()) {
+      if(ps2_read_data(p)) {
         // not sure what you do if start bit is high...
-        ps2_set_clk();
-        ps2_state = PS2_ST_IDLE;
-        ps2_disable_timer();
-        ps2_enable_clk_fall();
+        ps2_set_clk(p);
+        ps2_port[p].state = PS2_ST_IDLE;
+        ps2_disable_timer(p);
+        ps2_enable_clk_fall(p);
       } else {
-        ps2_state = PS2_ST_GET_START;
+        ps2_port[p].state = PS2_ST_GET_START;
       }
       break;
     case PS2_ST_GET_START:
-      ps2_set_clk();  // bring CLK hi
-      if(ps2_read_clk()) {
-        ps2_state = PS2_ST_WAIT_BIT;
+      ps2_set_clk(p);  // bring CLK hi
+      if(ps2_read_clk(p)) {
+        ps2_port[p].state = PS2_ST_WAIT_BIT;
       } else {
-        ps2_device_host_inhibit();
+        ps2_device_host_inhibit(p);
       }
       break;
     case PS2_ST_WAIT_BIT:
-      ps2_clear_clk();
+      ps2_clear_clk(p);
       // you read incoming bits on falling clock.
-      ps2_read_bit();
-      ps2_state = PS2_ST_GET_BIT;
+      ps2_read_bit(p);
+      ps2_port[p].state = PS2_ST_GET_BIT;
       break;
     case PS2_ST_GET_BIT:
-      ps2_set_clk();  // bring CLK hi
-      if(ps2_read_clk()) {
-        if(ps2_bit_count == 8) {
+      ps2_set_clk(p);  // bring CLK hi
+      if(ps2_read_clk(p)) {
+        if(ps2_port[p].bit_count == 8) {
           // done, do Parity bit
-          ps2_state = PS2_ST_GET_PARITY;
+          ps2_port[p].state = PS2_ST_GET_PARITY;
         } else {
-          ps2_state = PS2_ST_WAIT_BIT;
+          ps2_port[p].state = PS2_ST_WAIT_BIT;
         }
       } else {
         // host aborted send.
-        ps2_device_host_inhibit();
+        ps2_device_host_inhibit(p);
       }
       break;
     case PS2_ST_GET_PARITY:
-      ps2_clear_clk();
+      ps2_clear_clk(p);
       // ignore parity for now.
-      ps2_state = PS2_ST_WAIT_STOP;
+      ps2_port[p].state = PS2_ST_WAIT_STOP;
       break;
     case PS2_ST_WAIT_STOP:
-      ps2_set_clk();  // bring CLK hi
-      if(ps2_read_clk()) {
-        if(ps2_read_data()) {
-          ps2_state = PS2_ST_WAIT_ACK;
+      ps2_set_clk(p);  // bring CLK hi
+      if(ps2_read_clk(p)) {
+        if(ps2_read_data(p)) {
+          ps2_port[p].state = PS2_ST_WAIT_ACK;
           // bing DATA low to ack
-          ps2_clear_data();
+          ps2_clear_data(p);
           // commit data
-          //ps2_write_byte();  jlb, moved.
+          //ps2_write_byte(p);  jlb, moved.
         } else {
-          ps2_state = PS2_ST_GET_PARITY;
+          ps2_port[p].state = PS2_ST_GET_PARITY;
         }
       } else {
         // host aborted send.
-        ps2_device_host_inhibit();
+        ps2_device_host_inhibit(p);
       }
       break;
     case PS2_ST_WAIT_ACK:
-      ps2_clear_clk();
-      ps2_state = PS2_ST_GET_ACK;
+      ps2_clear_clk(p);
+      ps2_port[p].state = PS2_ST_GET_ACK;
       break;
     case PS2_ST_GET_ACK:
-      ps2_set_clk();
-      ps2_set_data();
+      ps2_set_clk(p);
+      ps2_set_data(p);
       // we just need to wait a 50uS or so, to ensure the host saw the CLK go high
-      ps2_holdoff_count = 1;
-      ps2_state = PS2_ST_HOLDOFF;
-      ps2_write_byte();   //jlb moved
+      ps2_port[p].holdoff_count = 1;
+      ps2_port[p].state = PS2_ST_HOLDOFF;
+      ps2_write_byte(p);   //jlb moved
       break;
     case PS2_ST_HOLDOFF:
-      ps2_holdoff_count--;
-      if(!ps2_holdoff_count) {
-        if(ps2_read_clk()) {
-          if(ps2_read_data()) {
-            ps2_check_for_data();
+      ps2_port[p].holdoff_count--;
+      if(!ps2_port[p].holdoff_count) {
+        if(ps2_read_clk(p)) {
+          if(ps2_read_data(p)) {
+            ps2_check_for_data(p);
           } else {
-            ps2_state = PS2_ST_WAIT_START;
+            ps2_port[p].state = PS2_ST_WAIT_START;
           }
         } else {
-          ps2_device_host_inhibit();
+          ps2_device_host_inhibit(p);
         }
       }
       break;
     default:
-      ps2_disable_timer();
+      ps2_disable_timer(p);
       break;
   }
 }
 
 
-static inline __attribute__((always_inline)) void ps2_device_clk_irq(void) {
-  ps2_disable_clk();
+static inline __attribute__((always_inline)) void ps2_device_clk_irq(uint8_t p) {
+  ps2_disable_clk(p);
 
-  switch(ps2_state) {
+  switch(ps2_port[p].state) {
     case PS2_ST_IDLE:
     case PS2_ST_PREP_START:
       // host is holding us off.  Wait for CLK hi...
-      ps2_device_host_inhibit();
+      ps2_device_host_inhibit(p);
       break;
     case PS2_ST_HOST_INHIBIT:
       // CLK went hi
-      if(ps2_read_data()) {
+      if(ps2_read_data(p)) {
         // we can send if we need to.
-        ps2_check_for_data();
+        ps2_check_for_data(p);
       } else {
         // host wants to send data, CLK is high.
         // wait half cycle to let things settle.
         // clock in data from host.
-        ps2_enable_timer(PS2_HALF_CYCLE);
-        ps2_state = PS2_ST_WAIT_START;
+        ps2_enable_timer(p, ps2_port[p].half_cycle);
+        ps2_port[p].state = PS2_ST_WAIT_START;
       }
       break;
     default:
@@ -531,68 +739,188 @@ static inline __attribute__((always_inline)) void ps2_device_clk_irq(void) {
   }
 }
 
-static void ps2_device_init(void) {
+static inline __attribute__((always_inline)) void ps2_device_init(void) {
+}
+
+/*
+ * half_cycle is the clock half period in uS, holdoff the gap after each
+ * byte in half cycles.  With adaptive set, holdoff is the longest gap
+ * and the actual one is tuned to what the host accepts.
+ */
+void ps2_port_set_timing(uint8_t p, uint8_t half_cycle, uint8_t holdoff, uint8_t adaptive) {
+  if(half_cycle < PS2_HALF_CYCLE_MIN)
+    half_cycle = PS2_HALF_CYCLE_MIN;
+  else if(half_cycle > PS2_HALF_CYCLE_MAX)
+    half_cycle = PS2_HALF_CYCLE_MAX;
+  if(holdoff < PS2_SEND_HOLDOFF_MIN)
+    holdoff = PS2_SEND_HOLDOFF_MIN;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    ps2_port[p].half_cycle = half_cycle;
+    ps2_port[p].holdoff_max = holdoff;
+    ps2_port[p].send_holdoff = holdoff;
+    ps2_port[p].adaptive = adaptive;
+    ps2_port[p].sent_ok = 0;
+  }
 }
 #endif
 
 ISR(PS2_TIMER_COMP_vect) {
-  PS2_CALL(ps2_device_timer_irq(),ps2_host_timer_irq());
+  PS2_CALL(0, ps2_device_timer_irq(0),ps2_host_timer_irq(0));
 }
 
 ISR(CLK_INT_vect) {
-  PS2_CALL(ps2_device_clk_irq(),ps2_host_clk_irq());
+  PS2_CALL(0, ps2_device_clk_irq(0),ps2_host_clk_irq(0));
 }
 
-uint8_t ps2_getc( void ) {
+#if PS2_PORTS > 1
+ISR(PS2_1_TIMER_COMP_vect) {
+  PS2_CALL(1, ps2_device_timer_irq(1),ps2_host_timer_irq(1));
+}
+
+ISR(PS2_1_CLK_INT_vect) {
+  // ignore the edge we are not waiting for.
+  if(!ps2_port[1].clk_rise == !ps2_read_clk(1))
+    PS2_CALL(1, ps2_device_clk_irq(1),ps2_host_clk_irq(1));
+}
+
+#  define PS2_ON_PORT(p, call) do { if(p) call(1); else call(0); } while(0)
+#else
+#  define PS2_ON_PORT(p, call) call(0)
+#endif
+
+uint8_t ps2_port_getc( uint8_t p ) {
   uint8_t tmptail;
 
-  while ( rx_head == rx_tail ) {
+  while ( ps2_port[p].rx_head == ps2_port[p].rx_tail ) {
     // wait for char to arrive, if none in Q
     ;
   }
   // Calculate buffer index
-  tmptail = ( rx_tail + 1 ) & PS2_RX_BUFFER_MASK;
+  tmptail = ( ps2_port[p].rx_tail + 1 ) & PS2_RX_BUFFER_MASK;
   // Store new index
-  rx_tail = tmptail;
-  return rxbuf[tmptail];
+  ps2_port[p].rx_tail = tmptail;
+  return ps2_port[p].rxbuf[tmptail];
 }
 
-void ps2_putc( uint8_t data ) {
+void ps2_port_putc( uint8_t p, uint8_t data ) {
   uint8_t tmphead;
   // Calculate buffer index
-  tmphead = ( tx_head + 1 ) & PS2_TX_BUFFER_MASK;
-  while ( tmphead == tx_tail ) {
+  tmphead = ( ps2_port[p].tx_head + 1 ) & PS2_TX_BUFFER_MASK;
+  while ( tmphead == ps2_port[p].tx_tail ) {
     // Wait for free space in buffer
     ;
   }
   // Store data in buffer
-  txbuf[tmphead] = data;
+  ps2_port[p].txbuf[tmphead] = data;
   // Store new index
-  tx_head = tmphead;
+  ps2_port[p].tx_head = tmphead;
 
   // turn off IRQs
   ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-    if(ps2_state == PS2_ST_IDLE) {
+    if(ps2_port[p].state == PS2_ST_IDLE) {
       // start transmission;
-      ps2_trigger_send();
+      PS2_ON_PORT(p, ps2_trigger_send);
     }
   }
 }
 
-uint8_t ps2_data_available( void ) {
-  return ( rx_head != rx_tail ); /* Return 0 (FALSE) if the receive buffer is empty */
+uint8_t ps2_port_data_available( uint8_t p ) {
+  return ( ps2_port[p].rx_head != ps2_port[p].rx_tail ); /* Return 0 (FALSE) if the receive buffer is empty */
 }
 
-void ps2_init(ps2mode_t mode) {
-  ps2_init_timer();
+#ifdef PS2_KB_MERGE
+/*
+ * Returns the port holding the oldest unread byte, or PS2_PORTS if all
+ * are empty.  Reading the ports in this order gives back the bytes in
+ * the order they arrived.  Only the IRQs write stamps and heads, only
+ * the reader moves the tails, so nothing needs locking.  Both rings
+ * together hold fewer than 128 bytes, so 8 bit stamps compare safely.
+ */
+uint8_t ps2_oldest_port(void) {
+  uint8_t p;
+  uint8_t port = PS2_PORTS;
+  uint8_t stamp = 0;
+  uint8_t tmp;
+
+  for(p = 0; p < PS2_PORTS; p++) {
+    if(ps2_port[p].rx_head != ps2_port[p].rx_tail) {
+      tmp = ps2_port[p].rxstamp[(ps2_port[p].rx_tail + 1) & PS2_RX_BUFFER_MASK];
+      if(port == PS2_PORTS || (int8_t)(tmp - stamp) < 0) {
+        port = p;
+        stamp = tmp;
+      }
+    }
+  }
+  return port;
+}
+#endif
+
+#ifdef PS2_MOUSE_SUPPORT
+/*
+ * len is 3, or 4 for a wheel mouse, to assemble mouse packets in the
+ * IRQ, or 0 to queue single bytes again, i.e. while sending commands.
+ */
+void ps2_port_set_packets(uint8_t p, uint8_t len) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    ps2_port[p].pkt_len = len;
+    ps2_port[p].pkt_count = 0;
+    ps2_port[p].ms_flags = 0;
+    ps2_port[p].ms_x = 0;
+    ps2_port[p].ms_y = 0;
+    ps2_port[p].ms_z = 0;
+    ps2_port[p].ms_clicked = 0;
+  }
+}
 
-  ps2_mode = mode;
-  ps2_clear_buffers();
+/* hands over the motion summed up since the last call, returns PS2_MS_* */
+uint8_t ps2_port_get_motion(uint8_t p, ps2motion_t *motion) {
+  uint8_t flags;
 
-  ps2_set_clk();
-  ps2_set_data();
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    flags = ps2_port[p].ms_flags;
+    motion->x = ps2_port[p].ms_x;
+    motion->y = ps2_port[p].ms_y;
+    motion->z = ps2_port[p].ms_z;
+    motion->buttons = ps2_port[p].ms_buttons;
+    motion->clicked = ps2_port[p].ms_clicked;
+    ps2_port[p].ms_flags = 0;
+    ps2_port[p].ms_x = 0;
+    ps2_port[p].ms_y = 0;
+    ps2_port[p].ms_z = 0;
+    ps2_port[p].ms_clicked = 0;
+  }
+  return flags;
+}
+
+uint8_t ps2_port_motion_pending(uint8_t p) {
+  return ps2_port[p].ms_flags;
+}
+#endif
+
+static inline __attribute__((always_inline)) void ps2_start(uint8_t p) {
+  // drop any send or timeout left over from before.
+  ps2_disable_timer(p);
+  ps2_set_clk(p);
+  ps2_set_data(p);
+
+  ps2_port[p].state = PS2_ST_IDLE;
+  ps2_enable_clk_fall(p);
+  PS2_CALL(p, ps2_device_init(),ps2_host_init());
+}
+
+void ps2_port_init(uint8_t p, ps2mode_t mode) {
+  ps2_init_timer();
+
+  ps2_port[p].mode = mode;
+  ps2_port[p].half_cycle = PS2_HALF_CYCLE;
+  ps2_port[p].send_holdoff = PS2_SEND_HOLDOFF_COUNT;
+  ps2_port[p].holdoff_max = PS2_SEND_HOLDOFF_COUNT;
+  ps2_port_clear_buffers(p);
+#if PS2_PORTS > 1
+  // the second port's clock is the only pin change IRQ on its bank.
+  if(p)
+    PS2_1_CLK_PCICR |= PS2_1_CLK_PCIE;
+#endif
 
-  ps2_state = PS2_ST_IDLE;
-  ps2_enable_clk_fall();
-  PS2_CALL(ps2_device_init(),ps2_host_init());
+  PS2_ON_PORT(p, ps2_start);
 }
@@ -39,6 +39,47 @@
 #  define PS2_TX_BUFFER_SHIFT 5
 #endif
 
+// number of PS/2 ports, the second one needs PS2_1_CLK_* and PS2_1_DATA_*
+#ifndef PS2_PORTS
+#  define PS2_PORTS 1
+#endif
+
+// the mouse gets a port of its own
+#ifdef PS2_MOUSE_SUPPORT
+#  if PS2_PORTS < 2
+#    error "PS/2 mouse support needs a second PS/2 port"
+#  endif
+#  ifndef PS2_MS_PORT
+#    define PS2_MS_PORT 1
+#  endif
+#endif
+
+// or a second keyboard, merged with the first
+#ifdef PS2_KB_MERGE
+#  if PS2_PORTS < 2
+#    error "Merging keyboards needs a second PS/2 port"
+#  endif
+#  ifdef PS2_MOUSE_SUPPORT
+#    error "The second PS/2 port takes a mouse or a keyboard, not both"
+#  endif
+#  if PS2_PORTS * (1 << PS2_RX_BUFFER_SHIFT) > 128
+#    error "Too many PS/2 receive bytes for 8 bit arrival stamps"
+#  endif
+#endif
+
+// or the keyboard, passed through to the PC on the first port
+#ifdef PS2_PASSTHRU
+#  if PS2_PORTS < 2
+#    error "PS/2 passthrough needs a second PS/2 port"
+#  endif
+#  if defined PS2_MOUSE_SUPPORT || defined PS2_KB_MERGE
+#    error "The second PS/2 port can only have one use"
+#  endif
+#  ifndef PS2_KB_PORT
+#    define PS2_KB_PORT 1
+#  endif
+#endif
+
 
 typedef enum { PS2_MODE_DEVICE = 1, PS2_MODE_HOST = 2 } ps2mode_t;
 
@@ -141,6 +182,9 @@ typedef enum { PS2_MODE_DEVICE = 1, PS2_MODE_HOST = 2 } ps2mode_t;
 #define PS2_KEY_RALT          0x11
 #define PS2_KEY_ECTRL         0x12
 #define PS2_KEY_RCTRL         0x14
+#define PS2_KEY_LGUI          0x1f
+#define PS2_KEY_RGUI          0x27
+#define PS2_KEY_APPS          0x2f
 #define PS2_KEY_NUM_SLASH     0x4a
 #define PS2_KEY_NUM_ENTER     0x5a
 #define PS2_KEY_END           0x69
@@ -153,6 +197,8 @@ typedef enum { PS2_MODE_DEVICE = 1, PS2_MODE_HOST = 2 } ps2mode_t;
 #define PS2_KEY_CRSR_UP       0x75
 #define PS2_KEY_PAGE_DOWN     0x7a
 #define PS2_KEY_PAGE_UP       0x7d
+// Ctrl-Pause
+#define PS2_KEY_BREAK         0x7e
 
 // significantly extended keys
 // E012E07C
@@ -193,6 +239,35 @@ typedef enum { PS2_MODE_DEVICE = 1, PS2_MODE_HOST = 2 } ps2mode_t;
 #define PS2_MS_CMD_READ_ID    PS2_CMD_READ_ID
 #define PS2_MS_CMD_READ_DATA  0xeb
 
+// an IntelliMouse answers READ_ID with this after rates 200, 100, 80
+#define PS2_MS_ID_WHEEL       3
+
+/* first byte of a mouse packet */
+#define PS2_MS_LEFT           (1 << 0)
+#define PS2_MS_RIGHT          (1 << 1)
+#define PS2_MS_MIDDLE         (1 << 2)
+#define PS2_MS_BUTTONS        (PS2_MS_LEFT | PS2_MS_RIGHT | PS2_MS_MIDDLE)
+#define PS2_MS_SYNC           (1 << 3)
+#define PS2_MS_X_SIGN         (1 << 4)
+#define PS2_MS_Y_SIGN         (1 << 5)
+#define PS2_MS_X_OVF          (1 << 6)
+#define PS2_MS_Y_OVF          (1 << 7)
+
+/* flags from ps2_port_get_motion() */
+#define PS2_MS_MOVED          1
+#define PS2_MS_REPLUGGED      2
+
+// summed motion stops here, so a slow reader does not wrap around
+#define PS2_MS_LIMIT          2047
+
+typedef struct {
+  int16_t x;
+  int16_t y;
+  int8_t  z;
+  uint8_t buttons;    // buttons down now
+  uint8_t clicked;    // buttons down at any time since the last read
+} ps2motion_t;
+
 #define PS2_RX_BUFFER_MASK   (_BV(PS2_RX_BUFFER_SHIFT) - 1)
 #define PS2_TX_BUFFER_MASK   (_BV(PS2_TX_BUFFER_SHIFT) - 1)
 /*
@@ -286,10 +361,39 @@ typedef enum { PS2_MODE_DEVICE = 1, PS2_MODE_HOST = 2 } ps2mode_t;
 #  error Unknown chip!
 #endif
 
+/* second port: clock on a pin change IRQ, timer on compare channel B */
+#if PS2_PORTS > 1
+#  if defined __AVR_ATmega28__ || defined __AVR_ATmega48__ || defined __AVR_ATmega88__ || defined __AVR_ATmega168__ || defined __AVR_ATmega328__
+#    define PS2_1_TIMER_COMP_vect TIMER2_COMPB_vect
+#    define PS2_1_OCR             OCR2B
+#    define PS2_1_TIFR_DATA       _BV(OCF2B)
+#    define PS2_1_TIMSK_DATA      _BV(OCIE2B)
+#    define PS2_1_CLK_PCIFR       PCIFR
+#    define PS2_1_CLK_PCICR       PCICR
+#    if PS2_1_CLK_PIN == _BV(PB5)
+#      define PS2_1_CLK_PCMSK     PCMSK0
+#      define PS2_1_CLK_PCINT     _BV(PCINT5)
+#      define PS2_1_CLK_PCIF      _BV(PCIF0)
+#      define PS2_1_CLK_PCIE      _BV(PCIE0)
+#      define PS2_1_CLK_INT_vect  PCINT0_vect
+#    else
+#      error "Please define PS2_1 CLK INT Settings"
+#    endif
+#  else
+#    error "A second PS/2 port needs a second timer compare channel"
+#  endif
+#endif
 
 
 #define PS2_HALF_CYCLE 36
 #define PS2_SEND_HOLDOFF_COUNT  ((uint8_t)(2140/PS2_HALF_CYCLE))
+// the spec allows a 10-16.7kHz clock
+#define PS2_HALF_CYCLE_MIN      30
+#define PS2_HALF_CYCLE_MAX      50
+// adaptive holdoff never goes below this many half cycles
+#define PS2_SEND_HOLDOFF_MIN    2
+// clean bytes needed before the adaptive holdoff shrinks again
+#define PS2_ADAPT_BYTES         16
 
 typedef enum {PS2_ST_IDLE
              ,PS2_ST_PREP_START
@@ -319,41 +423,82 @@ typedef enum {PS2_ST_IDLE
 static inline __attribute__((always_inline)) void ps2_init_timer(void) {
   // set prescaler to System Clock/8
   PS2_TCCR1 |= PS2_TCCR1_DATA;
+#if PS2_PORTS == 1
   // CTC mode
   PS2_TCCR2 |= PS2_TCCR2_DATA;
+#endif
 }
 
-static inline __attribute__((always_inline)) void ps2_set_clk(void) {
-  PS2_CLK_OUT |= PS2_CLK_PIN;
-  PS2_CLK_DDR &= (uint8_t)~PS2_CLK_PIN;
+/* pin access for port p, p is always a constant so one branch survives */
+static inline __attribute__((always_inline)) void ps2_set_clk(uint8_t p) {
+  if(p) {
+#if PS2_PORTS > 1
+    PS2_1_CLK_OUT |= PS2_1_CLK_PIN;
+    PS2_1_CLK_DDR &= (uint8_t)~PS2_1_CLK_PIN;
+#endif
+  } else {
+    PS2_CLK_OUT |= PS2_CLK_PIN;
+    PS2_CLK_DDR &= (uint8_t)~PS2_CLK_PIN;
+  }
 }
 
-static inline __attribute__((always_inline)) void ps2_clear_clk(void) {
-  PS2_CLK_DDR |= PS2_CLK_PIN;
-  PS2_CLK_OUT &= (uint8_t)~PS2_CLK_PIN;
+static inline __attribute__((always_inline)) void ps2_clear_clk(uint8_t p) {
+  if(p) {
+#if PS2_PORTS > 1
+    PS2_1_CLK_DDR |= PS2_1_CLK_PIN;
+    PS2_1_CLK_OUT &= (uint8_t)~PS2_1_CLK_PIN;
+#endif
+  } else {
+    PS2_CLK_DDR |= PS2_CLK_PIN;
+    PS2_CLK_OUT &= (uint8_t)~PS2_CLK_PIN;
+  }
 }
 
-static inline __attribute__((always_inline)) uint8_t ps2_read_clk(void) {
+static inline __attribute__((always_inline)) uint8_t ps2_read_clk(uint8_t p) {
+  if(p) {
+#if PS2_PORTS > 1
+    return PS2_1_CLK_IN & PS2_1_CLK_PIN;
+#endif
+  }
   return PS2_CLK_IN & PS2_CLK_PIN;
 }
 
-static inline __attribute__((always_inline)) void ps2_set_data(void) {
-  PS2_DATA_OUT |= PS2_DATA_PIN;
-  PS2_DATA_DDR &= (uint8_t)~PS2_DATA_PIN;
+static inline __attribute__((always_inline)) void ps2_set_data(uint8_t p) {
+  if(p) {
+#if PS2_PORTS > 1
+    PS2_1_DATA_OUT |= PS2_1_DATA_PIN;
+    PS2_1_DATA_DDR &= (uint8_t)~PS2_1_DATA_PIN;
+#endif
+  } else {
+    PS2_DATA_OUT |= PS2_DATA_PIN;
+    PS2_DATA_DDR &= (uint8_t)~PS2_DATA_PIN;
+  }
 }
 
-static inline __attribute__((always_inline)) void ps2_clear_data(void) {
-  PS2_DATA_DDR |= PS2_DATA_PIN;
-  PS2_DATA_OUT &= (uint8_t)~PS2_DATA_PIN;
+static inline __attribute__((always_inline)) void ps2_clear_data(uint8_t p) {
+  if(p) {
+#if PS2_PORTS > 1
+    PS2_1_DATA_DDR |= PS2_1_DATA_PIN;
+    PS2_1_DATA_OUT &= (uint8_t)~PS2_1_DATA_PIN;
+#endif
+  } else {
+    PS2_DATA_DDR |= PS2_DATA_PIN;
+    PS2_DATA_OUT &= (uint8_t)~PS2_DATA_PIN;
+  }
 }
 
-static inline __attribute__((always_inline)) uint8_t ps2_read_data(void) {
+static inline __attribute__((always_inline)) uint8_t ps2_read_data(uint8_t p) {
+  if(p) {
+#if PS2_PORTS > 1
+    return PS2_1_DATA_IN & PS2_1_DATA_PIN;
+#endif
+  }
   return PS2_DATA_IN & PS2_DATA_PIN;
 }
 
 #if defined PS2_ENABLE_HOST && defined PS2_ENABLE_DEVICE
-#define PS2_CALL(dev,host) \
-  switch(ps2_mode) {\
+#define PS2_CALL(p,dev,host) \
+  switch(ps2_port[p].mode) {\
   case PS2_MODE_DEVICE: \
     dev; \
     break; \
@@ -363,20 +508,38 @@ static inline __attribute__((always_inline)) uint8_t ps2_read_data(void) {
   }
 #else
 #  if defined PS2_ENABLE_DEVICE
-#    define PS2_CALL(dev,host) dev
+#    define PS2_CALL(p,dev,host) dev
 #  else
-#    define PS2_CALL(dev,host) host
+#    define PS2_CALL(p,dev,host) host
 #  endif
 #endif
 
-void ps2_init(ps2mode_t mode);
-uint8_t ps2_getc(void);
-void ps2_putc(uint8_t data);
-uint8_t ps2_data_available(void);
+void ps2_port_init(uint8_t port, ps2mode_t mode);
+uint8_t ps2_port_getc(uint8_t port);
+void ps2_port_putc(uint8_t port, uint8_t data);
+uint8_t ps2_port_data_available(uint8_t port);
+void ps2_port_clear_buffers(uint8_t port);
+void ps2_port_set_timing(uint8_t port, uint8_t half_cycle, uint8_t holdoff, uint8_t adaptive);
 void ps2_handle_cmds(uint8_t data);
 uint16_t ps2_get_typematic_delay(uint8_t rate);
 uint16_t ps2_get_typematic_period(uint8_t rate);
-void ps2_clear_buffers(void);
+#ifdef PS2_KB_MERGE
+uint8_t ps2_oldest_port(void);
+#endif
+#ifdef PS2_MOUSE_SUPPORT
+void ps2_port_set_packets(uint8_t port, uint8_t len);
+uint8_t ps2_port_get_motion(uint8_t port, ps2motion_t *motion);
+uint8_t ps2_port_motion_pending(uint8_t port);
+#endif
+
+// the first port keeps the single port names
+#define ps2_init(mode)          ps2_port_init(0, mode)
+#define ps2_getc()              ps2_port_getc(0)
+#define ps2_putc(data)          ps2_port_putc(0, data)
+#define ps2_data_available()    ps2_port_data_available(0)
+#define ps2_clear_buffers()     ps2_port_clear_buffers(0)
+#define ps2_set_timing(half_cycle, holdoff, adaptive) \
+                                ps2_port_set_timing(0, half_cycle, holdoff, adaptive)
 
 // Add 1 and multiply by 250ms to get time
 #define PS2_GET_DELAY(rate)   ((rate & 0x60) >> 5)
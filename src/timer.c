@@ -0,0 +1,55 @@
+/*
+    PS2Encoder - PS2 Keyboard to serial/parallel converter
+    Copyright Jim Brain and RETRO Innovations, 2008-2012
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+    timer.c: system timebase
+
+*/
+
+#include <inttypes.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include "config.h"
+#include "timer.h"
+
+static volatile uint8_t overflows;
+
+ISR(TIMER_OVF_vect) {
+  overflows++;
+}
+
+uint16_t timer_now(void) {
+  uint8_t hi;
+  uint8_t lo;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    lo = TIMER_TCNT >> 8;
+    hi = overflows;
+    // overflowed since IRQs went off, but not yet counted.
+    if((TIMER_TIFR & TIMER_TIFR_OVF) && lo < 0x80)
+      hi++;
+  }
+  return (hi << 8) | lo;
+}
+
+void timer_init(void) {
+  // normal mode, set prescaler to System Clock/8
+  TIMER_TCCR |= TIMER_TCCR_DATA;
+  TIMER_TIFR = TIMER_TIFR_OVF;
+  TIMER_TIMSK |= TIMER_TIMSK_OVF;
+}
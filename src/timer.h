@@ -0,0 +1,57 @@
+/*
+    PS2Encoder - PS2 Keyboard to serial/parallel converter
+    Copyright Jim Brain and RETRO Innovations, 2008-2012
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+    timer.h: public functions for the system timebase
+
+*/
+
+#ifndef TIMER_H
+#define TIMER_H
+
+/*
+ * Timer1 free runs at F_CPU/8 (see parallel.h).  Its overflows are
+ * counted here, and timer_now() returns the top 16 of those 24 bits,
+ * so one tick is 2048 clocks (256uS at 8MHz) and it wraps every ~16s.
+ */
+#if defined __AVR_ATmega8__ || defined __AVR_ATmega16__ || defined __AVR_ATmega32__ || defined __AVR_ATmega162__
+
+#  define TIMER_TIMSK           TIMSK
+#  define TIMER_TIFR            TIFR
+
+#elif defined __AVR_ATmega28__ || defined __AVR_ATmega48__ || defined __AVR_ATmega88__ || defined __AVR_ATmega168__ || defined __AVR_ATmega328__
+
+#  define TIMER_TIMSK           TIMSK1
+#  define TIMER_TIFR            TIFR1
+
+#else
+#  error Unknown chip!
+#endif
+
+#define TIMER_OVF_vect          TIMER1_OVF_vect
+#define TIMER_TCNT              TCNT1
+#define TIMER_TCCR              TCCR1B
+#define TIMER_TCCR_DATA         _BV(CS11)
+#define TIMER_TIFR_OVF          _BV(TOV1)
+#define TIMER_TIMSK_OVF         _BV(TOIE1)
+
+#define TIMER_MS(x)             ((uint16_t)((x) * (F_CPU / 2048) / 1000))
+
+void timer_init(void);
+uint16_t timer_now(void);
+
+#endif
@@ -35,11 +35,14 @@
 static uint8_t          tx0_buf[1 << UART0_TX_BUFFER_SHIFT];
 static volatile uint8_t tx0_tail;
 static volatile uint8_t tx0_head;
+static volatile uartflow_t tx0_flow;
+static volatile uint8_t tx0_paused;
 #  endif
 #  if defined UART0_RX_BUFFER_SHIFT && UART0_RX_BUFFER_SHIFT > 0
 static uint8_t          rx0_buf[1 << UART0_RX_BUFFER_SHIFT];
 static volatile uint8_t rx0_tail;
 static volatile uint8_t rx0_head;
+static volatile uint8_t rx0_errors;
 #  endif
 #endif
 
@@ -60,7 +63,15 @@ static volatile uint8_t rx1_tail;
 #if defined UART0_ENABLE
 #  if defined UART0_TX_BUFFER_SHIFT && UART0_TX_BUFFER_SHIFT > 0
 ISR(USARTA_UDRE_vect) {
-  if ( tx0_head != tx0_tail ) {
+  if ( tx0_head != tx0_tail && !tx0_paused ) {
+#    ifdef UART0_CTS_SUPPORT
+    if(tx0_flow == FLOW_RTS_CTS && !uart_cts()) {
+      /* Receiver not ready, sleep until CTS comes back */
+      UCSRAB &= ~ _BV(UDRIEA);
+      uart_cts_irq_on();
+      return;
+    }
+#    endif
     UDRA = tx0_buf[tx0_tail];     /* Start transmition */
     /* Calculate and store buffer index */
     tx0_tail = (tx0_tail + 1) & (sizeof(tx0_buf) - 1);
@@ -70,14 +81,51 @@ ISR(USARTA_UDRE_vect) {
 }
 #  endif
 
+#  ifdef UART0_CTS_SUPPORT
+ISR(UART0_CTS_vect) {
+  if(uart_cts()) {
+    uart_cts_irq_off();
+    UCSRAB |= _BV(UDRIEA);    /* Restart transmission */
+  }
+}
+#  endif
+
 #  if defined UART0_RX_BUFFER_SHIFT && UART0_RX_BUFFER_SHIFT > 0
 ISR(USARTA_RXC_vect) {
+  uint8_t status = UCSRAA;    /* Must be read before UDR */
+  uint8_t data = UDRA;        /* Read received data */
+
+  if(status & _BV(FEA)) {
+    /* Wrong bit rate, most likely.  Count it and drop the byte */
+    if(rx0_errors < 0xff)
+      rx0_errors++;
+    return;
+  }
+
+#    if defined UART0_TX_BUFFER_SHIFT && UART0_TX_BUFFER_SHIFT > 0
+  if(tx0_flow == FLOW_XON_XOFF) {
+    /* flow control characters are consumed here and never queued */
+    if(data == UART_XOFF) {
+      tx0_paused = TRUE;
+      return;
+    }
+    if(data == UART_XON) {
+      tx0_paused = FALSE;
+      UCSRAB |= _BV(UDRIEA);  /* Restart transmission */
+      return;
+    }
+  }
+#    endif
   /* Calculate and store buffer index */
   rx0_head = (rx0_head + 1) & (sizeof(rx0_buf) - 1);
   if ( rx0_head == rx0_tail ) {
     /* ERROR! Receive buffer overflow */
   }
-  rx0_buf[rx0_head] = UDRA; /* Read and store received data */
+  rx0_buf[rx0_head] = data;   /* Store received data */
+#    ifdef UART0_RTS_SUPPORT
+  if(((rx0_head - rx0_tail) & (sizeof(rx0_buf) - 1)) >= UART0_RX_HIGH_WATER)
+    uart_rts_off();           /* Ask the sender to stop */
+#    endif
 }
 #  endif
 
@@ -109,10 +157,17 @@ void uart_putc(uint8_t data) __attribute__ ((weak, alias("uart0_putc")));
 
 uint8_t uart0_getc(void) {
 #  if defined UART0_RX_BUFFER_SHIFT && UART0_RX_BUFFER_SHIFT > 0
+  uint8_t tmptail;
+
   while (rx0_head == rx0_tail) {;}
   /* Calculate and store buffer index */
-  rx0_tail = ( rx0_tail + 1 ) & (sizeof(rx0_buf)-1);
-  return rx0_buf[rx0_tail];           /* Return data */
+  tmptail = ( rx0_tail + 1 ) & (sizeof(rx0_buf)-1);
+  rx0_tail = tmptail;
+#    ifdef UART0_RTS_SUPPORT
+  if(((rx0_head - tmptail) & (sizeof(rx0_buf) - 1)) <= UART0_RX_LOW_WATER)
+    uart_rts_on();            /* Sender may resume */
+#    endif
+  return rx0_buf[tmptail];            /* Return data */
 #  else
   loop_until_bit_is_set(UCSRAA,RXCA);
   return UDRA;
@@ -145,12 +200,74 @@ void uart_putcrlf(void) __attribute__ ((weak, alias("uart0_putcrlf")));
 
 #  ifdef DYNAMIC_UART
 void uart0_config(uint16_t rate, uartlen_t length, uartpar_t parity, uartstop_t stopbits) {
-  UBRRAH = rate >> 8;
+  UBRRAH = (rate & UART_UBRR_MASK) >> 8;
   UBRRAL = rate & 0xff;
+  UCSRAA = (rate & UART_U2X ? _BV(U2XA) : 0);
 
   UART0_CONFIG(length, parity, stopbits);
 }
 void uart_config(uint16_t rate, uartlen_t length, uartpar_t parity, uartstop_t stopbits) __attribute__ ((weak, alias("uart0_config")));
+
+void uart0_set_flow(uartflow_t flow) {
+#    if defined UART0_TX_BUFFER_SHIFT && UART0_TX_BUFFER_SHIFT > 0
+  tx0_flow = flow;
+  if(flow != FLOW_XON_XOFF)
+    tx0_paused = FALSE;
+#      ifdef UART0_CTS_SUPPORT
+  if(flow != FLOW_RTS_CTS)
+    uart_cts_irq_off();
+#      endif
+  UCSRAB |= _BV(UDRIEA);      /* Flush anything held back */
+#    else
+  (void)flow;
+#    endif
+}
+void uart_set_flow(uartflow_t flow) __attribute__ ((weak, alias("uart0_set_flow")));
+
+uint8_t uart0_tx_paused(void) {
+#    if defined UART0_TX_BUFFER_SHIFT && UART0_TX_BUFFER_SHIFT > 0
+  return tx0_paused;
+#    else
+  return FALSE;
+#    endif
+}
+uint8_t uart_tx_paused(void) __attribute__ ((weak, alias("uart0_tx_paused")));
+
+/* TRUE once everything queued has been handed to the UART */
+uint8_t uart0_tx_idle(void) {
+#    if defined UART0_TX_BUFFER_SHIFT && UART0_TX_BUFFER_SHIFT > 0
+  return (tx0_head == tx0_tail);
+#    else
+  return ((UCSRAA & _BV(UDREA)) != 0);
+#    endif
+}
+uint8_t uart_tx_idle(void) __attribute__ ((weak, alias("uart0_tx_idle")));
+
+/* Returns the framing errors seen since the last call */
+uint8_t uart0_rx_errors(void) {
+#    if defined UART0_RX_BUFFER_SHIFT && UART0_RX_BUFFER_SHIFT > 0
+  uint8_t errors;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    errors = rx0_errors;
+    rx0_errors = 0;
+  }
+  return errors;
+#    else
+  return ((UCSRAA & _BV(FEA)) != 0);
+#    endif
+}
+uint8_t uart_rx_errors(void) __attribute__ ((weak, alias("uart0_rx_errors")));
+
+/* TRUE if there are framing errors, without clearing them */
+uint8_t uart0_rx_error_pending(void) {
+#    if defined UART0_RX_BUFFER_SHIFT && UART0_RX_BUFFER_SHIFT > 0
+  return (rx0_errors != 0);
+#    else
+  return ((UCSRAA & _BV(FEA)) != 0);
+#    endif
+}
+uint8_t uart_rx_error_pending(void) __attribute__ ((weak, alias("uart0_rx_error_pending")));
 #  endif
 
 void uart0_puthex(uint8_t hex) {
@@ -275,8 +392,9 @@ void uart1_puts(char* str) {
 
 #  ifdef DYNAMIC_UART
 void uart1_config(uint16_t rate, uartlen_t length, uartpar_t parity, uartstop_t stopbits) {
-  UBRRBH = rate >> 8;
+  UBRRBH = (rate & UART_UBRR_MASK) >> 8;
   UBRRBL = rate & 0xff;
+  UCSRBA = (rate & UART_U2X ? _BV(U2XB) : 0);
 
   UART1_CONFIG(length, parity, stopbits);
 }
@@ -290,13 +408,11 @@ void uart_init(void) {
 #  if defined UART0_ENABLE
   UART0_MODE_SETUP();
 
-  UBRRAH = CALC_BPS(UART0_BAUDRATE) >> 8;
+  UBRRAH = (CALC_BPS(UART0_BAUDRATE) & UART_UBRR_MASK) >> 8;
   UBRRAL = CALC_BPS(UART0_BAUDRATE) & 0xff;
 
-#    ifdef UART_DOUBLE_SPEED
-  /* double the speed of the serial port. */
-  UCSRAA = (1<<U2X0);
-#    endif
+  /* double the speed of the serial port, if that is closer */
+  UCSRAA = (CALC_BPS(UART0_BAUDRATE) & UART_U2X ? _BV(U2XA) : 0);
 
   /* Enable UART receiver and transmitter */
   UCSRAB = (0
@@ -318,6 +434,17 @@ void uart_init(void) {
   rx0_tail = 0;
   rx0_head = 0;
 #    endif
+#    ifdef UART0_RTS_SUPPORT
+  uart_rts_init();
+  uart_rts_on();
+#    endif
+#    if defined UART0_TX_BUFFER_SHIFT && UART0_TX_BUFFER_SHIFT > 0
+  tx0_flow = FLOW_NONE;
+  tx0_paused = FALSE;
+#    endif
+#    ifdef UART0_CTS_SUPPORT
+  uart_cts_init();
+#    endif
 
   stdout = &mystdout;
 #  endif
@@ -325,8 +452,9 @@ void uart_init(void) {
 #  ifdef UART1_ENABLE
   UART1_MODE_SETUP();
 
-  UBRRBH = CALC_BPS(UART1_BAUDRATE) >> 8;
+  UBRRBH = (CALC_BPS(UART1_BAUDRATE) & UART_UBRR_MASK) >> 8;
   UBRRBL = CALC_BPS(UART1_BAUDRATE) & 0xff;
+  UCSRBA = (CALC_BPS(UART1_BAUDRATE) & UART_U2X ? _BV(U2XB) : 0);
 
   /* Enable UART receiver and transmitter */
   UCSRBB = (0
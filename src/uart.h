@@ -25,11 +25,37 @@
 #ifndef UART_H
 #define UART_H
 
-#ifdef UART_DOUBLE_SPEED
-#define CALC_BPS(x) (int)((double)F_CPU/(8.0*x)-1)
-#else
-#define CALC_BPS(x) (int)((double)F_CPU/(16.0*x)-1)
-#endif
+/*
+ * UBRR is only 12 bits wide, so bit 15 of a CALC_BPS() value flags
+ * double speed (U2X) mode.  Both divisors are rounded to nearest, and
+ * whichever mode lands closer to the requested rate is used.  A rate too
+ * slow for 12 bits even in normal mode can't be set, CALC_BPS_ERROR()
+ * returns BPS_NO_FIT for it.  Neither can one further than BPS_MAX_ERROR
+ * from the request in the better mode, the receiver would miss bits.
+ */
+#define UART_U2X              0x8000
+#define UART_UBRR_MASK        0x0fff
+
+#define UBRR_NORMAL(x)        ((F_CPU + 8UL * (x)) / (16UL * (x)) - 1)
+#define UBRR_DOUBLE(x)        ((F_CPU + 4UL * (x)) / (8UL * (x)) - 1)
+#define BPS_NORMAL(x)         (F_CPU / (16UL * (UBRR_NORMAL(x) + 1)))
+#define BPS_DOUBLE(x)         (F_CPU / (8UL * (UBRR_DOUBLE(x) + 1)))
+#define BPS_DIFF(a,b)         ((a) > (b) ? (a) - (b) : (b) - (a))
+#define BPS_FITS(x)           (UBRR_NORMAL(x) <= UART_UBRR_MASK)
+#define BPS_NO_FIT            0xff
+// in tenths of a percent, 57600 at 8MHz is 2.1% off and works
+#define BPS_MAX_ERROR         25
+#define BPS_USE_DOUBLE(x)     (UBRR_DOUBLE(x) <= UART_UBRR_MASK \
+                               && BPS_DIFF(BPS_DOUBLE(x), (x)) < BPS_DIFF(BPS_NORMAL(x), (x)))
+
+#define CALC_BPS(x)           ((uint16_t)(BPS_USE_DOUBLE(x) \
+                                          ? (UBRR_DOUBLE(x) | UART_U2X) \
+                                          : UBRR_NORMAL(x)))
+// deviation of CALC_BPS(x) from x, in tenths of a percent
+#define CALC_BPS_ERROR(x)     ((uint8_t)(!BPS_FITS(x) ? BPS_NO_FIT \
+                                         : (BPS_USE_DOUBLE(x) \
+                                            ? BPS_DIFF(BPS_DOUBLE(x), (x)) \
+                                            : BPS_DIFF(BPS_NORMAL(x), (x))) * 1000UL / (x)))
 
 #define B0300   CALC_BPS(300)
 #define B0600   CALC_BPS(600)
@@ -61,6 +87,7 @@
 #    define USBSA  USBS1
 #    define URSELA URSEL1
 #    define RXCA   RXC1
+#    define FEA    FE1
 #    define RXENA  RXEN1
 #    define TXCA   TXC1
 #    define TXENA  TXEN1
@@ -112,6 +139,7 @@
 #    define USBSA  USBS0
 #    define URSELA URSEL0
 #    define RXCA   RXC0
+#    define FEA    FE0
 #    define RXENA  RXEN0
 #    define TXCA   TXC0
 #    define TXENA  TXEN0
@@ -165,6 +193,7 @@
 
 #  define UDRA  UDR0
 #  define RXCA   RXC0
+#  define FEA    FE0
 #  define RXENA  RXEN0
 #  define TXCA   TXC0
 #  define TXENA  TXEN0
@@ -174,15 +203,17 @@
 #  define UCSRAB UCSR0B
 #  define UCSRAC UCSR0C
 #  define UDRIEA UDRIE0
+#  define RXCIEA RXCIE0
 #  define U2XA   U2X0
 #  define USARTA_UDRE_vect USART_UDRE_vect
-#  define USARTA_RXC_vect USART_RXC_vect
+#  define USARTA_RXC_vect USART_RX_vect
 
 #elif defined __AVR_ATtiny2313__ || defined __AVR_ATtiny4313__ || defined __AVR_ATmega165__ || defined __AVR_ATmega165A__ || defined __AVR_ATmega165P__ || defined __AVR_ATmega165PA__ || defined __AVR_ATmega32__ || defined __AVR_ATmega16__ || defined __AVR_ATmega8__
 // only 1 uart
 #  define UDREA  UDRE
 #  define UDRA   UDR
 #  define RXCA   RXC
+#  define FEA    FE
 #  define RXENA  RXEN
 #  define TXCA   TXC
 #  define TXENA  TXEN
@@ -192,6 +223,7 @@
 #  define UCSRAB UCSRB
 #  define UCSRAC UCSRC
 #  define UDRIEA UDRIE
+#  define RXCIEA RXCIE
 #  define URSELA URSEL
 #  define U2XA   U2X
 #  if defined __AVR_ATmega165__
@@ -274,6 +306,16 @@ void uart_putcrlf(void);
 
 #endif
 
+#if defined UART0_RX_BUFFER_SHIFT && UART0_RX_BUFFER_SHIFT > 0
+/* RTS is dropped at the high mark and raised again at the low mark */
+#  ifndef UART0_RX_HIGH_WATER
+#    define UART0_RX_HIGH_WATER  ((1 << UART0_RX_BUFFER_SHIFT) * 3 / 4)
+#  endif
+#  ifndef UART0_RX_LOW_WATER
+#    define UART0_RX_LOW_WATER   ((1 << UART0_RX_BUFFER_SHIFT) / 4)
+#  endif
+#endif
+
 #if defined UART0_ENABLE
 uint8_t uart0_getc(void);
 void uart0_putc(uint8_t data);
@@ -336,10 +378,28 @@ typedef enum {PARITY_NONE = UART_PARITY_NONE,
               PARITY_ODD = UART_PARITY_ODD
              } uartpar_t;
 
+typedef enum {FLOW_NONE = 0,
+              FLOW_RTS_CTS,
+              FLOW_XON_XOFF
+             } uartflow_t;
+
+#define UART_XON           0x11
+#define UART_XOFF          0x13
+
 #if defined UART0_ENABLE && defined DYNAMIC_UART
 void uart_config(uint16_t rate, uartlen_t length, uartpar_t parity, uartstop_t stopbits);
+void uart_set_flow(uartflow_t flow);
+uint8_t uart_tx_paused(void);
+uint8_t uart_tx_idle(void);
+uint8_t uart_rx_errors(void);
+uint8_t uart_rx_error_pending(void);
 #else
 #define uart_config(bps, length, parity, stopbits) do {} while(0)
+#define uart_set_flow(flow) do {} while(0)
+#define uart_tx_paused()    0
+#define uart_tx_idle()      1
+#define uart_rx_errors()    0
+#define uart_rx_error_pending() 0
 #endif
 
 #if defined UART1_ENABLE && defined DYNAMIC_UART
@@ -30,16 +30,27 @@
 #include <inttypes.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 #include <util/atomic.h>
 #include <util/delay.h>
 #include "config.h"
+#include "timer.h"
 #include "xt.h"
 #include "uart.h"
 
-static uint8_t buf[1 << XT_BUFFER_SHIFT];
-static volatile uint8_t head;
-static volatile uint8_t tail;
+// separate rings, so received codes and queued output never collide.
+#ifdef XT_ENABLE_HOST
+static uint8_t rxbuf[1 << XT_BUFFER_SHIFT];
+static volatile uint8_t rx_head;
+static volatile uint8_t rx_tail;
+#endif
+#ifdef XT_ENABLE_DEVICE
+static uint8_t txbuf[1 << XT_BUFFER_SHIFT];
+static volatile uint8_t tx_head;
+static volatile uint8_t tx_tail;
+#endif
 
+// one XT port only, so the bit engine state stays in plain globals.
 static volatile xtstate_t xt_state;
 static volatile uint8_t xt_byte;
 static volatile uint8_t xt_bit_count;
@@ -48,11 +59,39 @@ static xtmode_t xt_mode;
 
 static volatile uint8_t xt_timer_count;
 
+#ifdef XT_ENABLE_HOST
+// CLK falls since last asked, a frame's length tells XT from PS/2.
+static volatile uint8_t xt_clocks;
+#endif
+
+#ifdef XT_ENABLE_DEVICE
+/*
+ * {CLK high uS, CLK low uS, gap in 100uS ticks}, less ISR overhead.
+ * A real 5150 keyboard, what most clones accept, and what a PC/XT BIOS
+ * ISR can just keep up with.
+ */
+static const uint8_t xt_timings[XT_TIMING_COUNT][3] PROGMEM = {
+  [XT_TIMING_5150]  = {XT_CLK_HIGH_BIT_TIME, XT_CLK_LOW_BIT_TIME, XT_CHAR_GAP},
+  [XT_TIMING_CLONE] = {40 - 8,               20 - 5,              3},
+  [XT_TIMING_FAST]  = {20 - 8,               12 - 5,              1},
+};
+
+static uint8_t xt_high_time = XT_CLK_HIGH_BIT_TIME;
+static uint8_t xt_low_time = XT_CLK_LOW_BIT_TIME;
+static uint8_t xt_gap = XT_CHAR_GAP;
+static uint8_t xt_gap_max = XT_CHAR_GAP;
+static uint8_t xt_adaptive;
+static uint8_t xt_sent_ok;
+// set while the HOLDOFF in progress follows one of our characters
+static uint8_t xt_char_sent;
+static uint16_t xt_hold_start;
+#endif
+
 static void xt_enable_clk_rise(void) {
   // turn off IRQ
   XT_CLK_INTCR &= (uint8_t)~_BV(XT_CLK_INT);
   // reset flag
-  XT_CLK_INTFR |= _BV(XT_CLK_INTF);
+  XT_CLK_INTFR = _BV(XT_CLK_INTF);
 #if XT_CLK_PIN == _BV(PB5)
   PCMSK0 |= _BV(PCINT5);
 #else
@@ -67,7 +106,7 @@ static void xt_enable_clk_fall(void) {
   // turn off IRQ
   XT_CLK_INTCR &= (uint8_t)~_BV(XT_CLK_INT);
   // reset flag
-  XT_CLK_INTFR |= _BV(XT_CLK_INTF);
+  XT_CLK_INTFR = _BV(XT_CLK_INTF);
   // falling edge
 #  if XT_CLK_PIN == _BV(PB5)
   PCMSK0 |= _BV(PCINT5);
@@ -84,7 +123,7 @@ static inline __attribute__((always_inline)) void xt_disable_clk(void) {
 
 static void xt_enable_timer(uint8_t us) {
   // clear flag.
-  XT_TIFR |= XT_TIFR_DATA;
+  XT_TIFR = XT_TIFR_DATA;
   // clear TCNT;
   XT_TCNT = 0;
   // set the count...
@@ -106,10 +145,25 @@ static inline __attribute__((always_inline)) void xt_disable_timer(void) {
   XT_TIMSK &= (uint8_t)~XT_TIMSK_DATA;
 }
 
+#ifdef XT_ENABLE_DEVICE
+static void xt_clear_tx(void) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    tx_head = 0;
+    tx_tail = 0;
+  }
+}
+#endif
+
 void xt_clear_buffers(void) {
   ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-    head = 0;
-    tail = 0;
+#ifdef XT_ENABLE_HOST
+    rx_head = 0;
+    rx_tail = 0;
+#endif
+#ifdef XT_ENABLE_DEVICE
+    tx_head = 0;
+    tx_tail = 0;
+#endif
   }
 }
 
@@ -129,12 +183,12 @@ static void xt_read_bit(void) {
 
 static void xt_write_byte(void) {
   /* Calculate buffer index and store */
-  head = ( head + 1 ) & XT_BUFFER_MASK;
+  rx_head = ( rx_head + 1 ) & XT_BUFFER_MASK;
 
-  if ( head == tail ) {
+  if ( rx_head == rx_tail ) {
     /* ERROR! Receive buffer overflow */
   }
-  buf[head] = xt_byte; /* Store received data in buffer */
+  rxbuf[rx_head] = xt_byte; /* Store received data in buffer */
 }
 
 static inline void xt_host_timer_irq(void) {
@@ -152,6 +206,8 @@ static inline void xt_host_timer_irq(void) {
 
 
 static inline __attribute__((always_inline)) void xt_host_clk_irq(void) {
+  if(xt_clocks < 255)
+    xt_clocks++;
   // if we don't get another CLK in 200uS, timeout.
   xt_enable_timer(200);
   switch(xt_state) {
@@ -209,8 +265,8 @@ static void xt_write_bit(void) {
 
 static void xt_read_byte(void) {
   xt_bit_count = 0;
-  xt_byte = buf[( tail + 1 ) & XT_BUFFER_MASK];  /* Start transmission */
-  tail = ( tail + 1 ) & XT_BUFFER_MASK;      /* Store new index */
+  xt_byte = txbuf[( tx_tail + 1 ) & XT_BUFFER_MASK];  /* Start transmission */
+  tx_tail = ( tx_tail + 1 ) & XT_BUFFER_MASK;      /* Store new index */
 }
 
 static void xt_trigger_send(void) {
@@ -224,7 +280,7 @@ static void xt_trigger_send(void) {
 
 static void xt_device_check_data(void) {
   // do we have data to send?
-  if( head != tail ) {
+  if( tx_head != tx_tail ) {
     xt_trigger_send();
   } else {
     xt_state = XT_ST_IDLE;
@@ -233,18 +289,38 @@ static void xt_device_check_data(void) {
   }
 }
 
+/*
+ * Adaptive gap: CLK low after one of our characters, timed from when we
+ * let go of it, is the host pushing back, so double the gap.  While it
+ * releases CLK at once, shorten the gap by a tick every XT_ADAPT_CHARS
+ * characters.  Holdoffs the host starts on its own and resets are not
+ * measured here.
+ */
+static void xt_device_adapt(uint8_t held) {
+  if(!xt_adaptive)
+    return;
+  if(held) {
+    xt_sent_ok = 0;
+    xt_gap = (xt_gap && xt_gap < xt_gap_max / 2 ? xt_gap << 1 : xt_gap_max);
+  } else if(++xt_sent_ok >= XT_ADAPT_CHARS) {
+    xt_sent_ok = 0;
+    if(xt_gap)
+      xt_gap--;
+  }
+}
+
 static inline __attribute__((always_inline)) void xt_device_timer_irq(void) {
   switch (xt_state) {
     case XT_ST_INIT:
       // this is supposed to happen 7.5uS after CLK goes low, but it's OK to delay it to here.
-      xt_enable_timer(XT_CLK_HIGH_START_TIME);
+      xt_enable_timer(xt_high_time);
       xt_set_data();  // real start bit
       xt_set_clk();   // bring CLK high
       xt_read_byte();
       xt_state = XT_ST_PREP_START;
       break;
     case XT_ST_PREP_START:
-      xt_enable_timer(XT_CLK_LOW_START_TIME);
+      xt_enable_timer(xt_low_time);
       xt_clear_clk();
       xt_state = XT_ST_SEND_START;
       break;
@@ -253,11 +329,11 @@ static inline __attribute__((always_inline)) void xt_device_timer_irq(void) {
       xt_set_clk();  // bring CLK hi
       // technically, data should be set ~18uS after CLK goes low, but
       // delaying it until CLK goes high does not hurt.
-      xt_enable_timer(XT_CLK_HIGH_BIT_TIME);
+      xt_enable_timer(xt_high_time);
       xt_write_bit();
       break;
     case XT_ST_PREP_BIT:
-      xt_enable_timer(XT_CLK_LOW_BIT_TIME);
+      xt_enable_timer(xt_low_time);
       xt_clear_clk();
       xt_state = XT_ST_SEND_BIT;
       break;
@@ -269,6 +345,8 @@ static inline __attribute__((always_inline)) void xt_device_timer_irq(void) {
         // wait for CLK to go high
         xt_state = XT_ST_HOLDOFF;
         xt_timer_count = 0;
+        xt_char_sent = TRUE;
+        xt_hold_start = TIMER_TCNT;
         xt_enable_timer(XT_TIMER_100US);
         xt_enable_clk_rise();
         xt_set_clk();  // bring CLK hi
@@ -285,7 +363,7 @@ static inline __attribute__((always_inline)) void xt_device_timer_irq(void) {
     case XT_ST_WAIT:
       // we timed out
       xt_timer_count++;
-      if(xt_timer_count >= 6) {  // we have finished our interchar wait time.
+      if(xt_timer_count >= xt_gap) {  // we have finished our interchar wait time.
         xt_disable_clk();
         xt_device_check_data();
       }
@@ -312,20 +390,24 @@ static inline __attribute__((always_inline)) void xt_device_clk_irq(void) {
       // host is holding us off.  Might be trying to reset. Wait for CLK hi...
       xt_state = XT_ST_HOLDOFF;
       xt_timer_count = 0;
+      xt_char_sent = FALSE;
       xt_enable_timer(XT_TIMER_100US);
       xt_enable_clk_rise();
       xt_set_clk();  // bring CLK hi
       xt_set_data(); // in case needed
       break;
     case XT_ST_HOLDOFF:
-      if(xt_timer_count < 6) {
+      if(xt_char_sent && xt_timer_count < 60)
+        xt_device_adapt((uint16_t)(TIMER_TCNT - xt_hold_start) >= XT_HOLD_MIN);
+      xt_char_sent = FALSE;
+      if(xt_timer_count < xt_gap) {
         xt_enable_clk_fall();  // in case PC takes us low while we are waiting.
         xt_state = XT_ST_WAIT;
       } else { // we either need to reset, or we need to check for a new char
         xt_disable_timer();
         if(xt_timer_count >= 60) {
-          xt_clear_buffers();
-          xt_putc(0xaa);
+          xt_clear_tx();
+          xt_putc(XT_CMD_BAT);
           xt_timer_count = 0;
           xt_enable_timer(XT_TIMER_100US);
           xt_state = XT_ST_RESET;
@@ -343,6 +425,23 @@ static void xt_device_init(void) {
   xt_clear_data(); // data low is idle state
   xt_enable_clk_fall(); // in case reset is needed
 }
+
+/*
+ * Select a timing profile.  With adaptive set, the profile's gap is the
+ * longest one used, and the gap is tuned to what the host accepts.
+ */
+void xt_set_timing(uint8_t profile, uint8_t adaptive) {
+  if(profile >= XT_TIMING_COUNT)
+    profile = XT_TIMING_5150;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    xt_high_time = pgm_read_byte(&xt_timings[profile][0]);
+    xt_low_time = pgm_read_byte(&xt_timings[profile][1]);
+    xt_gap_max = pgm_read_byte(&xt_timings[profile][2]);
+    xt_gap = xt_gap_max;
+    xt_adaptive = adaptive;
+    xt_sent_ok = 0;
+  }
+}
 #endif
 
 ISR(XT_TIMER_COMP_vect) {
@@ -355,17 +454,27 @@ ISR(XT_CLK_INT_vect) {
 
 #ifdef XT_ENABLE_HOST
 uint8_t xt_getc( void ) {
-  while ( head == tail ) {
+  while ( rx_head == rx_tail ) {
     // wait for char to arrive, if none in Q
     ;
   }
   // Calculate buffer index and store
-  tail = ( tail + 1 ) & XT_BUFFER_MASK;
-  return buf[tail];
+  rx_tail = ( rx_tail + 1 ) & XT_BUFFER_MASK;
+  return rxbuf[rx_tail];
 }
 
 uint8_t xt_data_available( void ) {
-  return ( head != tail ); /* Return 0 (FALSE) if the receive buffer is empty */
+  return ( rx_head != rx_tail ); /* Return 0 (FALSE) if the receive buffer is empty */
+}
+
+uint8_t xt_host_clocks(void) {
+  uint8_t clocks;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    clocks = xt_clocks;
+    xt_clocks = 0;
+  }
+  return clocks;
 }
 #endif
 
@@ -375,15 +484,15 @@ void xt_putc( uint8_t data ) {
   uint8_t tmphead;
 
   // Calculate buffer index
-  tmphead = ( head + 1 ) & XT_BUFFER_MASK;
-  while ( tmphead == tail ) {
+  tmphead = ( tx_head + 1 ) & XT_BUFFER_MASK;
+  while ( tmphead == tx_tail ) {
     // Wait for free space in buffer
     ;
   }
   // Store data in buffer
-  buf[tmphead] = data;
+  txbuf[tmphead] = data;
   // Store new index
-  head = tmphead;
+  tx_head = tmphead;
 
   // turn off IRQs
   ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
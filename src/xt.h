@@ -135,6 +135,7 @@ typedef enum { XT_MODE_DEVICE = 1, XT_MODE_HOST = 2 } xtmode_t;
 #define XT_KEY_NUM_3        0x51
 #define XT_KEY_NUM_0        0x52
 #define XT_KEY_NUM_PERIOD   0x53
+#define XT_KEY_SYSRQ        0x54
 #define XT_KEY_INT1         0x56
 #define XT_KEY_F11          0x57
 #define XT_KEY_F12          0x58
@@ -155,6 +156,11 @@ typedef enum { XT_MODE_DEVICE = 1, XT_MODE_HOST = 2 } xtmode_t;
 #define XT_KEY_PAGE_DOWN        0x51
 #define XT_KEY_INSERT           0x52
 #define XT_KEY_DELETE           0x53
+#define XT_KEY_LGUI             0x5b
+#define XT_KEY_RGUI             0x5c
+#define XT_KEY_APPS             0x5d
+// Ctrl-Pause
+#define XT_KEY_BREAK            0x46
 
 //significantly extended keys
 //E02A E037
@@ -162,6 +168,12 @@ typedef enum { XT_MODE_DEVICE = 1, XT_MODE_HOST = 2 } xtmode_t;
 //E11D 45 E19D C5
 #define XT_KEY_PAUSE            0x45
 
+// key detection error/buffer overrun
+#define XT_CMD_ERROR            0x00
+#define XT_CMD_OVERFLOW         0xff
+// self test passed, sent at power-up and after a reset
+#define XT_CMD_BAT              0xaa
+
 
 #define XT_BUFFER_MASK   (_BV(XT_BUFFER_SHIFT) - 1)
 
@@ -170,6 +182,19 @@ typedef enum { XT_MODE_DEVICE = 1, XT_MODE_HOST = 2 } xtmode_t;
 #define XT_CLK_HIGH_BIT_TIME    (80 - 8)
 #define XT_CLK_LOW_BIT_TIME     (36 - 5)
 #define XT_TIMER_100US          (100 - 8)
+// 100uS ticks between characters
+#define XT_CHAR_GAP             6
+
+// device mode timing profiles, see xt_timings[] in xt.c
+#define XT_TIMING_5150          0
+#define XT_TIMING_CLONE         1
+#define XT_TIMING_FAST          2
+#define XT_TIMING_COUNT         3
+// adaptive gap: clean characters needed before the gap shrinks again
+#define XT_ADAPT_CHARS          16
+// CLK low for longer than this after a character is the host pushing back,
+// in Timer1 (F_CPU/8) ticks, ~10uS
+#define XT_HOLD_MIN             ((uint16_t)(F_CPU / 800000UL))
 
 typedef enum  {XT_ST_IDLE
               ,XT_ST_RESET
@@ -337,14 +362,20 @@ uint8_t xt_getc(void);
 void xt_putc(uint8_t data);
 #endif
 uint8_t xt_data_available(void);
+uint8_t xt_host_clocks(void);
 void xt_clear_buffers(void);
+#ifdef XT_ENABLE_DEVICE
+void xt_set_timing(uint8_t profile, uint8_t adaptive);
+#endif
 
 #else
 #  define xt_init(mode)           do {} while(0)
 #  define xt_getc(void)           0
 #  define xt_putc(data)           do {} while(0)
 #  define xt_data_available(void) 0
+#  define xt_host_clocks(void)    0
 #  define xt_clear_buffers(void)  do {} while(0)
+#  define xt_set_timing(profile, adaptive) do {} while(0)
 #endif
 
 #endif